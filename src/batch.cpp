@@ -0,0 +1,208 @@
+#include "batch.h"
+#include "emit.h"
+#include "lanes.h"
+#include "workers.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+// runs read at a time; their results are held until every earlier run is written
+static const size_t BATCH_CHUNK = 1024;
+
+// runs of the board, one per record; on lanes, or one at a time
+struct BatchRun : Task{
+	const BoardCall *call;
+	LaneCall *records;
+	int count;
+	bool lanes;
+
+	void run() override {
+		if(lanes){
+			run_lanes(*call, records, count);
+			return;
+		}
+		for(LaneCall *record = records; record != records + count; ++record){
+			BoardCall::RunState *rs = call->new_run_state(record->inputs);
+			rs->capture_stdout(&record->stdout_text);
+			if(!rs->run()){
+				delete rs;
+				continue;
+			}
+			std::copy(rs->outputs, rs->outputs + 36, record->outputs);
+			record->output_left = rs->output_left;
+			record->output_right = rs->output_right;
+			record->reason = rs->exit_reason();
+			BoardCall::recycle(rs);
+		}
+	}
+};
+
+bool parse_batch_format(const std::string &name, BatchFormat &result){
+	if(name == "text")
+		result = BATCH_TEXT;
+	else if(name == "binary")
+		result = BATCH_BINARY;
+	else
+		return false;
+	return true;
+}
+
+// reads the arguments of a run from a line of text; false (after emitting an error) if invalid
+static inline bool _parse_line(const std::string &line, const std::string &where, int inputs, LaneCall &record){
+	std::istringstream fields(line);
+	std::string field;
+	int count = 0;
+	while(fields >> field){
+		unsigned value = 0;
+		bool too_large = false;
+		for(char c : field){
+			if(!std::isdigit(static_cast<unsigned char>(c))){
+				emit_error(where + ": Argument value " + field + " is not a nonnegative integer");
+				return false;
+			}
+			value = 10 * value + (c - '0');
+			if(value > 255){
+				too_large = true;
+				value &= 255;
+			}
+		}
+		if(too_large)
+			emit_warning(where + ": Argument value " + field + " is larger than 255; using value mod 256");
+		if(count < inputs)
+			record.inputs[count] = value;
+		++count;
+	}
+	if(count != inputs){
+		emit_error(where + ": Expected " + std::to_string(inputs) + " inputs, got " + std::to_string(count));
+		return false;
+	}
+	return true;
+}
+
+static inline void _write(OutputSink &sink, const std::string &text){
+	for(char c : text)
+		sink.write(c);
+}
+
+static inline void _write_result(OutputSink &sink, const LaneCall &record, int length, BatchFormat format){
+	uint16_t outputs[38]; // {0..{Z, {<, {>
+	std::copy(record.outputs, record.outputs + 36, outputs);
+	outputs[36] = record.output_left;
+	outputs[37] = record.output_right;
+	if(format == BATCH_BINARY){
+		for(uint16_t output : outputs){
+			sink.write((output >> 8) ? 1 : 0);
+			sink.write((output >> 8) ? output & 0xFF : 0);
+		}
+		sink.write(record.reason);
+		for(int i = 0; i < 4; ++i)
+			sink.write(record.stdout_text.size() >> 8 * i);
+		for(uint8_t c : record.stdout_text)
+			sink.write(c);
+		return;
+	}
+	std::string line;
+	for(int i = 0; i < 38; ++i){
+		if(i == length)
+			i = 36;
+		uint16_t output = outputs[i];
+		line += (output >> 8) ? std::to_string(output & 0xFF) + " " : "- ";
+	}
+	switch(record.reason){
+		case EXIT_TERMINATOR: line += "terminator "; break;
+		case EXIT_NO_ACTIVITY: line += "no-activity "; break;
+		case EXIT_OUTPUTS_FILLED: line += "outputs-filled "; break;
+		default: line += "error "; break;
+	}
+	static const char digits[] = "0123456789ABCDEF";
+	for(uint8_t c : record.stdout_text){
+		line += digits[c >> 4];
+		line += digits[c & 15];
+	}
+	if(record.stdout_text.empty())
+		line += "-";
+	line += "\n";
+	_write(sink, line);
+}
+
+int run_batch(Interpreter &interpreter, const std::string &file, int inputs, BatchFormat format, bool lanes){
+	std::ifstream fs;
+	if(file != "-"){
+		fs.open(file.c_str(), std::ios_base::in | std::ios_base::binary);
+		if(fs.fail()){
+			emit_error("Could not open batch file " + file);
+			return -9;
+		}
+	}
+	std::istream &in = file == "-" ? std::cin : fs;
+	std::string name = file == "-" ? "STDIN" : file;
+	if(format == BATCH_BINARY && inputs == 0){
+		emit_error("Binary batches need a board with inputs");
+		return -4;
+	}
+
+	BoardCall call = interpreter.main_call();
+	// records of a chunk, and the runs covering them: LANES records per run on lanes
+	std::vector<LaneCall> records(BATCH_CHUNK);
+	std::vector<std::unique_ptr<BatchRun>> runs;
+	int per_run = lanes ? LANES : 1;
+	unsigned long line_number = 0;
+	bool failed = false;
+	while(!failed){
+		// read a chunk of records
+		size_t count = 0;
+		while(count < BATCH_CHUNK){
+			LaneCall &record = records[count];
+			record = LaneCall();
+			if(format == BATCH_BINARY){
+				char bytes[36];
+				if(!in.read(bytes, inputs)){
+					if(in.gcount() != 0){
+						emit_error(name + ": Incomplete record at the end");
+						failed = true;
+					}
+					break;
+				}
+				std::copy(bytes, bytes + inputs, record.inputs);
+			}else{
+				std::string line;
+				if(!std::getline(in, line))
+					break;
+				++line_number;
+				if(!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if(!_parse_line(line, name + ":" + std::to_string(line_number), inputs, record)){
+					failed = true;
+					break;
+				}
+			}
+			++count;
+		}
+		if(count == 0)
+			break;
+		runs.clear();
+		for(size_t i = 0; i < count; i += per_run){
+			std::unique_ptr<BatchRun> run(new BatchRun);
+			run->call = &call;
+			run->records = &records[i];
+			run->count = std::min<size_t>(per_run, count - i);
+			run->lanes = lanes;
+			runs.push_back(std::move(run));
+		}
+		// this thread takes the first run next, other workers the last ones
+		for(size_t i = runs.size(); i --> 0;)
+			workers.push(runs[i].get());
+		for(const std::unique_ptr<BatchRun> &run : runs){
+			workers.wait(*run);
+			for(int i = 0; i < run->count; ++i)
+				_write_result(*interpreter.output, run->records[i], call.board->length, format);
+		}
+		interpreter.output->flush_if_due();
+	}
+	return failed ? -4 : 0;
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "interpreter.h"
+
+#include <string>
+
+// --batch: runs one board many times, once for each record of an input file
+// runs are spread over the worker pool; results are written in input order
+// with the lanes engine, each task runs up to LANES records side by side
+
+enum BatchFormat{
+	// input: a line of whitespace-separated arguments per run, as on the command line
+	// results: a line per run, see run_batch
+	BATCH_TEXT,
+	// input: a byte per argument per run
+	// results: a fixed-size header per run followed by its stdout, see run_batch
+	BATCH_BINARY,
+};
+
+// parses the argument of --batch-format; returns false if not a format name
+bool parse_batch_format(const std::string &name, BatchFormat &result);
+
+// runs the main board of interpreter once for each record of file ("-" for stdin)
+// with arguments inputs, the number of arguments the board takes, and writes a
+// result per run to the interpreter's output. text results are
+//   OUT... LEFT RIGHT EXIT STDOUT
+// with the board's outputs ({0 up to its length), its left and right outputs ({< {>)
+// in decimal or - when empty, EXIT one of terminator, no-activity, outputs-filled or
+// error, and STDOUT in hex or - when empty. binary results are 38 pairs of bytes
+// (1 if set, value) for outputs {0..{Z, {< and {>, a byte for ExitReason (EXIT_RUNNING
+// for errors), the length of STDOUT as 4 bytes little endian, and STDOUT
+// lanes: run the records LANES at a time with run_lanes; board must be lanes_supported
+// returns 0, or an error code (after emitting an error) if the input cannot be read
+int run_batch(Interpreter &interpreter, const std::string &file, int inputs, BatchFormat format, bool lanes);
+
+#endif // BATCH_H
@@ -0,0 +1,43 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	#include <immintrin.h>
+#endif
+
+// bit tricks shared by the engines working on bitsets of cells or lanes
+
+// index of the lowest set bit of a nonzero word
+static inline uint32_t lowest_bit(uint64_t bits){
+	#ifdef __GNUC__
+		return __builtin_ctzll(bits);
+	#else
+		uint32_t n = 0;
+		while(!(bits & 1))
+			bits >>= 1, ++n;
+		return n;
+	#endif
+}
+
+// 0xFF in each byte whose bit is set, 0x00 elsewhere
+#if defined(__SSE2__)
+	static inline __m128i byte_mask_16(uint32_t bits){
+		const uint64_t spread = UINT64_C(0x0101010101010101);
+		const __m128i select = _mm_set1_epi64x(UINT64_C(0x8040201008040201));
+		__m128i mask = _mm_set_epi64x((bits >> 8 & 0xFF) * spread, (bits & 0xFF) * spread);
+		return _mm_cmpeq_epi8(_mm_and_si128(mask, select), select);
+	}
+#endif
+#if defined(__AVX2__)
+	static inline __m256i byte_mask_32(uint32_t bits){
+		const uint64_t spread = UINT64_C(0x0101010101010101);
+		const __m256i select = _mm256_set1_epi64x(UINT64_C(0x8040201008040201));
+		__m256i mask = _mm256_set_epi64x((bits >> 24 & 0xFF) * spread, (bits >> 16 & 0xFF) * spread,
+		                                 (bits >> 8 & 0xFF) * spread, (bits & 0xFF) * spread);
+		return _mm256_cmpeq_epi8(_mm256_and_si256(mask, select), select);
+	}
+#endif
+
+#endif // BITS_H
@@ -1,14 +1,40 @@
+#include "bits.h"
 #include "board.h"
 #include "cell.h"
 #include "devices.h"
 #include "emit.h"
+#include "interpreter.h"
 #include "io_functions.h"
-#include "options.h"
+#include "workers.h"
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <new>
 #include <utility>
 
+#ifdef ALLOC_CHECK
+// build with -DALLOC_CHECK to count heap allocations; RunState::run() then warns about
+// ticks of the outermost board (after the first) that allocate. run with --memo-limit=0,
+// as filling the call cache allocates, and without --threads (the count is not atomic)
+static unsigned long long alloc_count = 0;
+
+void *operator new(std::size_t size){
+	++alloc_count;
+	if(void *ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+#endif // ALLOC_CHECK
+
+const uint32_t Board::ROUTE_STDOUT;
+const uint32_t Board::ROUTE_DESTROYED;
+const uint32_t Board::PROGRAM_FALL;
+
 BoardCall::BoardCall(Board *board, uint16_t x, uint16_t y): board(board), x(x), y(y){}
 
 // check if a uint16_t represents a marble or an empty cell
@@ -16,6 +42,71 @@ static inline bool is_empty_cell(uint16_t value){
 	return !(value & 0xFF00);
 }
 
+// n (at most 32) bits of a bitset starting at bit pos; bits past the end of the bitset are 0
+static inline uint32_t extract_bits(const uint64_t *words, uint32_t word_count, uint32_t pos, uint32_t n){
+	uint32_t word = pos / 64, offset = pos % 64;
+	uint64_t bits = words[word] >> offset;
+	if(offset + n > 64 && word + 1 < word_count)
+		bits |= words[word + 1] << (64 - offset);
+	return static_cast<uint32_t>(bits & ((UINT64_C(1) << n) - 1));
+}
+
+#if VMARBELOUS == 0 && defined(__AVX2__)
+	static const uint32_t FALL_LANES = 32;
+	typedef __m256i FallVector;
+	// where falling: src merged into dest (dest counts only where occupied); elsewhere dest
+	static inline void merge_lanes(const uint8_t *src, uint8_t *dest, uint32_t falling, uint32_t occupied){
+		__m256i f = byte_mask_32(falling);
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dest));
+		__m256i merged = _mm256_add_epi8(_mm256_and_si256(d, byte_mask_32(occupied)),
+		                                 _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
+		d = _mm256_or_si256(_mm256_and_si256(f, merged), _mm256_andnot_si256(f, d));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dest), d);
+	}
+#elif VMARBELOUS == 0 && defined(__SSE2__)
+	static const uint32_t FALL_LANES = 16;
+	// where falling: src merged into dest (dest counts only where occupied); elsewhere dest
+	static inline void merge_lanes(const uint8_t *src, uint8_t *dest, uint32_t falling, uint32_t occupied){
+		__m128i f = byte_mask_16(falling);
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest));
+		__m128i merged = _mm_add_epi8(_mm_and_si128(d, byte_mask_16(occupied)),
+		                              _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+		d = _mm_or_si128(_mm_and_si128(f, merged), _mm_andnot_si128(f, d));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dest), d);
+	}
+#endif
+
+// splitmix64 finalizer
+static inline uint64_t mix_hash(uint64_t x){
+	x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return x ^ (x >> 31);
+}
+
+// key of a marble of the given value on cell loc; the hash of a grid is the xor of
+// the keys of its marbles. computed instead of looked up in a table of random keys,
+// which would need 256 entries per cell
+static inline uint64_t marble_hash(uint32_t loc, uint8_t value){
+	return mix_hash((static_cast<uint64_t>(loc) << 8 | value) + UINT64_C(0x9E3779B97F4A7C15));
+}
+
+// sparse bookkeeping is needed by engines that only visit cells holding marbles
+static inline bool tracks_occupancy(Engine engine){
+	return engine == ENGINE_SPARSE || engine == ENGINE_BYTECODE || engine == ENGINE_TILES;
+}
+
+// board calls are processed in the same order as they are listed: top-bottom left-right
+static inline bool is_before(const BoardCall *a, const BoardCall *b){
+	return a->y < b->y || (a->y == b->y && a->x < b->x);
+}
+
+// sorts the board calls touched by marbles this tick and adds calls that are always ready
+static inline void order_board_calls(std::vector<const BoardCall *> &calls, const Board &board){
+	calls.insert(calls.end(), board.always_ready_calls.begin(), board.always_ready_calls.end());
+	std::sort(calls.begin(), calls.end(), is_before);
+	calls.erase(std::unique(calls.begin(), calls.end()), calls.end());
+}
+
 BoardCall::RunState *BoardCall::call(const BoardCall *bc, uint8_t inputs[], int indents){
 	return bc->call(inputs, indents);
 }
@@ -24,130 +115,565 @@ BoardCall::RunState *BoardCall::call(uint8_t inputs[], int indents) const {
 	// prepare runstate
 	RunState *rs = new_run_state(inputs, indents);
 
-	if(verbosity > 2)
+	if(interpreter->settings.verbosity > 2)
 		rs->output_board();
 
 	// run to completion
-	while(rs->tick(false));
-
-	rs->finalize();
+	if(!rs->run()){
+		delete rs;
+		return nullptr;
+	}
 
 	return rs;
 }
 
 BoardCall::RunState *BoardCall::new_run_state(uint8_t inputs[], int indents) const {
-	// prepare runstate
-	RunState *rs = new RunState;
+	// reuse a finished runstate of this board if there is one
+	RunState *rs;
+	uint32_t size = board->width * board->height;
+	auto &free_states = board->free_states[WorkerPool::current()];
+	if(!free_states.empty()){
+		rs = free_states.back().release();
+		free_states.pop_back();
+		rs->tick_number = 0;
+		std::fill(rs->outputs, rs->outputs + 36, 0);
+		rs->output_left = rs->output_right = 0;
+		rs->marbles_moved = true;
+		rs->terminator_reached = false;
+		rs->cycle.armed = rs->cycle.have_saved = rs->cycle.stuck = false;
+	}else{
+		rs = new RunState;
+		// both grids share one allocation, starting out empty
+		uint32_t words = MarbleGrid::words(size);
+		rs->grids.resize(2 * words + 2 * MarbleGrid::words(8 * size) + 8, 0);
+		rs->cur_marbles.occupied = rs->grids.data();
+		rs->next_marbles.occupied = rs->grids.data() + words;
+		uint8_t *values = reinterpret_cast<uint8_t *>(rs->grids.data() + 2 * words);
+		rs->cur_marbles.values = values;
+		rs->next_marbles.values = values + size;
+		rs->stdout_values.resize(board->width);
+	}
+	rs->tracks_occupancy = tracks_occupancy(interpreter->settings.engine);
+	if(rs->tracks_occupancy)
+		rs->stdout_columns.reserve(board->width);
 	rs->bc = this;
 	rs->indents = indents;
-	// fill with empty cell placeholders
-	rs->cur_marbles.resize(board->width * board->height, 0);
-	rs->next_marbles.resize(board->width * board->height, 0);
+	rs->captured_stdout = nullptr;
+	rs->call_failed = false;
+	rs->random = interpreter->new_random();
+	rs->cycle.report = interpreter->settings.on_cycle != CYCLE_IGNORE;
 	// initialize board values
 	for(const std::pair<uint32_t, uint8_t> &marble : board->initial_marbles)
-		rs->cur_marbles[marble.first] = marble.second | 0xFF00;
+		rs->place_marble(marble.first, marble.second);
 	for(int i = 0; i < 36; ++i)
 		for(uint32_t loc : board->inputs[i])
-			rs->cur_marbles[loc] = inputs[i] | 0xFF00;
-	// set unused outputs to prefill
-	for(int i = 0; i < 36; ++i)
-		rs->outputs_filled[i] = board->outputs[i].empty();
-	rs->left_filled = board->output_left.empty();
-	rs->right_filled = board->output_right.empty();
-	// if there are no outputs, then don't exit based on all outputs filled
-	rs->no_output = std::find(rs->outputs_filled.begin(), rs->outputs_filled.end(), false) == rs->outputs_filled.end()
-	                 && rs->left_filled && rs->right_filled;
-	// reserve space for stdout
-	rs->stdout_values.resize(board->width);
+			rs->place_marble(loc, inputs[i]);
+	rs->outputs_filled = 0;
 
 	return rs;
 }
 
-BoardCall::RunState::~RunState(){
-	for(const auto rs : prepared_board_calls)
-		delete rs;
-	for(const auto rs : processed_board_calls)
+void BoardCall::recycle(RunState *rs){
+	// runstates stopped in the middle of a tick have marbles on both grids
+	if(rs->in_tick){
 		delete rs;
+		return;
+	}
+	// next_marbles and stdout_values are cleared after every tick, so
+	// only the marbles left on cur_marbles have to be removed
+	if(rs->tracks_occupancy){
+		for(uint32_t index : rs->cur_live.cells)
+			rs->cur_marbles.occupied[index / 64] = 0;
+		rs->cur_live.cells.clear();
+		rs->cur_live.synchronisers = 0;
+	}else{
+		rs->cur_marbles.clear(rs->bc->board->cells.size());
+	}
+	rs->cur_live.board_calls.clear();
+	rs->stdout_text.clear();
+	#if VMARBELOUS == 1
+		rs->moved_marbles.clear();
+	#endif
+	rs->bc->board->free_states[WorkerPool::current()].emplace_back(rs);
 }
 
-void BoardCall::RunState::prepare_board_calls(){
-	for(const auto &board_call : bc->board->board_calls){
-		uint32_t loc = bc->board->index(board_call.x, board_call.y);
-		bool canCall = true;
-		for(int i = 0; i < board_call.board->length; ++i)
-			if(!board_call.board->inputs[i].empty() && is_empty_cell(cur_marbles[loc + i])){
-				canCall = false;
-				break;
+bool BoardCall::RunState::run(){
+	return run(indents);
+}
+
+bool BoardCall::RunState::run(int base){
+	// calls are run from this stack rather than by recursion, so the
+	// depth of nested calls is only limited by memory (and max_depth)
+	base_indents = base;
+	const Settings &settings = bc->interpreter->settings;
+	std::vector<RunState *> stack{this};
+	#ifdef ALLOC_CHECK
+		unsigned long long tick_allocs = 0;
+	#endif
+	while(true){
+		RunState *top = stack.back();
+		#ifdef ALLOC_CHECK
+			if(top == this && !mid_tick()){
+				if(tick_number > 1 && alloc_count != tick_allocs)
+					emit_warning("ALLOC_CHECK: " + std::to_string(alloc_count - tick_allocs)
+					             + " heap allocations during tick " + std::to_string(tick_number)
+					             + " of board " + bc->board->full_name);
+				tick_allocs = alloc_count;
 			}
-		if(!canCall){
-			for(uint32_t i = loc, end = loc + board_call.board->length; i < end; ++i){
-				if(!is_empty_cell(cur_marbles[i]))
-					set_marble(i, 0, 0, cur_marbles[i]);
+		#endif
+		if(!top->mid_tick() && top->is_finished()){
+			top->finalize();
+			if(top == this)
+				return true;
+			stack.pop_back();
+			stack.back()->resume(top);
+			continue;
+		}
+		RunState *rs = top->step();
+		if((!rs && (top->cycle.stuck || top->call_failed)) || (settings.parallel_calls && workers.cancelled())){
+			delete rs;
+			for(RunState *frame : stack)
+				if(frame != this)
+					delete frame;
+			return false;
+		}
+		if(!rs)
+			continue;
+		if(settings.max_depth && static_cast<unsigned long>(rs->indents - base_indents) > settings.max_depth){
+			// calls failing side by side on the worker pool report one error
+			if(!settings.parallel_calls || workers.cancel())
+				emit_error("Maximum call depth of " + std::to_string(settings.max_depth)
+				           + " exceeded when calling board " + rs->bc->board->full_name);
+			delete rs;
+			for(RunState *frame : stack)
+				if(frame != this)
+					delete frame;
+			return false;
+		}
+		if(settings.verbosity > 2)
+			rs->output_board();
+		rs->base_indents = base;
+		stack.push_back(rs);
+	}
+}
+
+BoardCall::RunState *BoardCall::RunState::step(){
+	if(!in_tick){
+		in_tick = true;
+		marbles_moved = false;
+		// only calls holding marbles can be ready
+		order_board_calls(cur_live.board_calls, *bc->board);
+		next_live_call = 0;
+		#if VMARBELOUS == 0
+			start_cycle_check();
+			if(bc->interpreter->settings.parallel_calls && run_calls_in_parallel())
+				next_live_call = cur_live.board_calls.size();
+			if(call_failed)
+				return nullptr;
+		#endif
+	}
+	// board calls; stops at the first call that needs to be run
+	while(next_live_call < cur_live.board_calls.size()){
+		RunState *rs = process_boardcall(*cur_live.board_calls[next_live_call++]);
+		if(rs)
+			return rs;
+	}
+
+	finish_tick();
+	in_tick = false;
+	// (vmarbelous cannot block while it is animating)
+	#if VMARBELOUS == 0
+		cycle_check();
+	#endif
+	return nullptr;
+}
+
+void BoardCall::RunState::start_cycle_check(){
+	const InputSource &input = *bc->interpreter->input;
+	cycle.stdin_reads = input.read_count();
+	cycle.stdout_bytes = stdout_count();
+	cycle.stdin_misses = input.miss_count();
+}
+
+void BoardCall::RunState::cycle_check(){
+	Interpreter &interpreter = *bc->interpreter;
+	InputSource &input = *interpreter.input;
+	// only ticks (including any calls made) that read and output nothing can be skipped
+	if(input.read_count() != cycle.stdin_reads || stdout_count() != cycle.stdout_bytes || is_finished()){
+		cycle.have_saved = false;
+		cycle.armed = cycle.report;
+		return;
+	}
+	if(!cycle.armed){
+		if(!cycle.report && input.miss_count() == cycle.stdin_misses)
+			return;
+		arm_cycle_check();
+	}
+	uint64_t hash = state_hash();
+	if(cycle.have_saved && hash == cycle.saved_hash){
+		take_snapshot(cycle.current);
+		if(cycle.current == cycle.saved){
+			cycle.have_saved = false;
+			if(input.miss_count() != cycle.saved_misses){
+				// nothing changes until there is input
+				input.wait();
+				return;
 			}
-		}else{
-			uint8_t inputs[36] = { };
-			for(int i = 0; i < board_call.board->length; ++i)
-				inputs[i] = cur_marbles[loc + i] & 0xFF;
-			RunState *rs = board_call.new_run_state(inputs, indents + 1);
-			prepared_board_calls.push_back(rs);
+			if(!cycle.report)
+				return;
+			std::string message = "Board " + bc->board->full_name + " repeats the same "
+			                      + std::to_string(tick_number - cycle.saved_tick)
+			                      + " ticks forever from tick " + std::to_string(cycle.saved_tick);
+			if(interpreter.settings.on_cycle == CYCLE_ABORT){
+				if(!interpreter.settings.parallel_calls || workers.cancel())
+					emit_error(message);
+				cycle.stuck = true;
+			}else{
+				// the board may run until killed, so show the warning right away
+				// (output of calls on the worker pool is written out by their callers)
+				if(!captured_stdout)
+					interpreter.output->flush();
+				emit_warning(message);
+				std::fflush(stdout);
+				cycle.report = false;
+			}
+			return;
 		}
 	}
+	if(!cycle.have_saved || ++cycle.length == cycle.power){
+		if(!cycle.have_saved)
+			cycle.power = 1;
+		else
+			cycle.power *= 2;
+		cycle.saved_hash = hash;
+		take_snapshot(cycle.saved);
+		cycle.have_saved = true;
+		cycle.length = 0;
+		cycle.saved_tick = tick_number;
+		cycle.saved_misses = input.miss_count();
+	}
 }
 
-bool BoardCall::RunState::tick(bool use_prepared){
-	marbles_moved = false;
-	if(use_prepared){
-		for(const auto rs : processed_board_calls){
-			uint32_t loc = bc->board->index(rs->bc->x, rs->bc->y);
-			for(int i = 0; i < rs->bc->board->length; ++i)
-				if(!is_empty_cell(rs->outputs[i]))
-					set_marble(loc + i, 0, 1, rs->outputs[i]);
-			if(!is_empty_cell(rs->output_left))
-				set_marble(loc, -1, 0, rs->output_left);
-			if(!is_empty_cell(rs->output_right))
-				set_marble(loc + (rs->bc->board->length - 1), 1, 0, rs->output_right);
-			marbles_moved = true;
+void BoardCall::RunState::arm_cycle_check(){
+	// called between ticks, when next_marbles is empty
+	cur_hash = next_hash = 0;
+	for(uint32_t word = 0, words = MarbleGrid::words(bc->board->cells.size()); word < words; ++word){
+		for(uint64_t bits = cur_marbles.occupied[word]; bits; bits &= bits - 1){
+			uint32_t loc = 64 * word + lowest_bit(bits);
+			cur_hash ^= marble_hash(loc, cur_marbles.values[loc]);
+		}
+	}
+	cycle.armed = true;
+	cycle.have_saved = false;
+}
+
+uint64_t BoardCall::RunState::state_hash() const {
+	uint64_t hash = cur_hash ^ mix_hash(outputs_filled);
+	for(int i = 0; i < Random::STATE_WORDS; ++i)
+		hash = mix_hash(hash ^ random.get_state()[i]);
+	return hash;
+}
+
+void BoardCall::RunState::take_snapshot(std::vector<uint64_t> &snapshot) const {
+	// marbles, random state and output flags; everything else is derived from these
+	uint32_t words = MarbleGrid::words(bc->board->cells.size());
+	snapshot.assign(cur_marbles.occupied, cur_marbles.occupied + words);
+	uint64_t packed = 0;
+	unsigned count = 0;
+	for(uint32_t word = 0; word < words; ++word){
+		for(uint64_t bits = cur_marbles.occupied[word]; bits; bits &= bits - 1){
+			packed = packed << 8 | cur_marbles.values[64 * word + lowest_bit(bits)];
+			if(++count % 8 == 0)
+				snapshot.push_back(packed), packed = 0;
 		}
+	}
+	snapshot.push_back(packed);
+	snapshot.insert(snapshot.end(), random.get_state(), random.get_state() + Random::STATE_WORDS);
+	snapshot.push_back(outputs_filled);
+}
+
+void BoardCall::RunState::resume(RunState *rs){
+	if(running_call_cacheable){
+		CallResult result;
+		std::copy(rs->outputs, rs->outputs + 36, result.outputs);
+		result.output_left = rs->output_left;
+		result.output_right = rs->output_right;
+		bc->interpreter->call_cache.insert(rs->bc->board, running_call_inputs, result);
+	}
+	apply_call_outputs(*rs->bc, rs->outputs, rs->output_left, rs->output_right);
+	recycle(rs);
+}
+
+struct BoardCall::RunState::CallTask : Task{
+	RunState *rs;
+	bool cacheable;
+	uint8_t inputs[36];
+	std::vector<uint8_t> captured_stdout;
+	bool ok = false;
+
+	void run() override {
+		rs->captured_stdout = &captured_stdout;
+		ok = !workers.cancelled() && rs->run(rs->base_indents);
+		if(!ok){
+			// everything else stops as well; the program exits with an error
+			delete rs;
+			workers.cancel();
+		}
+	}
+};
+
+// nested waits for calls run on the worker pool use the native stack
+static const unsigned MAX_PARALLEL_NESTING = 64;
+static thread_local unsigned parallel_nesting = 0;
+
+bool BoardCall::RunState::run_calls_in_parallel(){
+	const Settings &settings = bc->interpreter->settings;
+	// verbose modes print traces as boards run
+	if(settings.verbosity > 0 || parallel_nesting >= MAX_PARALLEL_NESTING)
+		return false;
+	// let step() report calls nested too deep
+	if(settings.max_depth && static_cast<unsigned long>(indents + 1 - base_indents) > settings.max_depth)
+		return false;
+	// stdin has to be read in call order; and one call is run as fast without the pool
+	unsigned ready = 0;
+	for(const BoardCall *board_call : cur_live.board_calls){
+		if(!call_ready(*board_call))
+			continue;
+		if(board_call->board->reads_stdin)
+			return false;
+		++ready;
+	}
+	if(ready < 2)
+		return false;
+	std::vector<std::unique_ptr<CallTask>> tasks;
+	for(const BoardCall *board_call : cur_live.board_calls){
+		RunState *rs = process_boardcall(*board_call);
+		if(!rs)
+			continue;
+		tasks.emplace_back(new CallTask);
+		CallTask &task = *tasks.back();
+		task.rs = rs;
+		rs->base_indents = base_indents;
+		task.cacheable = running_call_cacheable;
+		std::copy(running_call_inputs, running_call_inputs + 36, task.inputs);
+	}
+	// the first call is run here; other workers take the last ones first, and this
+	// thread takes the second one next, unless it has been taken
+	++parallel_nesting;
+	for(size_t i = tasks.size(); i --> 1;)
+		workers.push(tasks[i].get());
+	if(!tasks.empty())
+		tasks[0]->run();
+	for(size_t i = 1; i < tasks.size(); ++i)
+		workers.wait(*tasks[i]);
+	--parallel_nesting;
+	// apply outputs and write stdout in call order, up to the first call that failed
+	for(const std::unique_ptr<CallTask> &task : tasks){
+		if(call_failed){
+			if(task->ok)
+				recycle(task->rs);
+			continue;
+		}
+		if(!task->ok){
+			call_failed = true;
+			continue;
+		}
+		for(uint8_t value : task->captured_stdout)
+			write_stdout(value);
+		running_call_cacheable = task->cacheable;
+		std::copy(task->inputs, task->inputs + 36, running_call_inputs);
+		resume(task->rs);
+	}
+	return true;
+}
+
+struct BoardCall::RunState::Tile : Task{
+	RunState *rs;
+	const uint32_t *begin, *end; // live cells to process
+	uint32_t first, last; // cells owned by the tile, whole occupancy words of them
+	bool moved = false, terminated = false;
+	uint64_t outputs_filled = 0;
+	Occupancy live; // cells of the tile receiving marbles
+	// marbles landing outside the tile or falling to stdout: target and value
+	std::vector<std::pair<uint32_t, uint8_t>> outbox;
+
+	void run() override {
+		rs->run_program(begin, end, this);
+	}
+};
+
+// a band gets at least this many live cells; smaller ticks are faster on one thread
+static const size_t MIN_TILE_CELLS = 2048;
+
+bool BoardCall::RunState::run_tiles(){
+	// (vmarbelous animates marbles in the order they moved)
+	#if VMARBELOUS == 1
+		return false;
+	#else
+		const Board &board = *bc->board;
+		// next_hash is updated in the order marbles land
+		if(!workers.enabled() || board.ordered_cells || cycle.armed)
+			return false;
+		size_t count = cur_live.cells.size();
+		size_t bands = std::min<size_t>(workers.size(), count / MIN_TILE_CELLS);
+		if(bands < 2)
+			return false;
+		// split the live cells evenly, moving each boundary back to the start of its
+		// occupancy word so that no two tiles write the same word of next_marbles
+		const uint32_t *cells = cur_live.cells.data();
+		std::vector<std::unique_ptr<Tile>> tiles;
+		size_t start = 0;
+		uint32_t first = 0;
+		for(size_t band = 1; band <= bands; ++band){
+			uint32_t last = band == bands ? board.cells.size() : cells[count * band / bands] / 64 * 64;
+			if(last <= first)
+				continue;
+			size_t end = std::lower_bound(cells + start, cells + count, last) - cells;
+			tiles.emplace_back(new Tile);
+			Tile &tile = *tiles.back();
+			tile.rs = this;
+			tile.begin = cells + start;
+			tile.end = cells + end;
+			tile.first = first;
+			tile.last = last;
+			start = end;
+			first = last;
+		}
+		for(size_t i = tiles.size(); i --> 1;)
+			workers.push(tiles[i].get());
+		tiles[0]->run();
+		for(size_t i = 1; i < tiles.size(); ++i)
+			workers.wait(*tiles[i]);
+		// as if the cells had been processed in order: merges only add up, and the
+		// marbles each tile passed on are applied in cell order, which keeps the last
+		// marble falling into a stdout column
+		for(const std::unique_ptr<Tile> &tile : tiles){
+			marbles_moved |= tile->moved;
+			terminator_reached |= tile->terminated;
+			outputs_filled |= tile->outputs_filled;
+			next_live.cells.insert(next_live.cells.end(), tile->live.cells.begin(), tile->live.cells.end());
+			next_live.board_calls.insert(next_live.board_calls.end(), tile->live.board_calls.begin(), tile->live.board_calls.end());
+			next_live.synchronisers |= tile->live.synchronisers;
+		}
+		for(const std::unique_ptr<Tile> &tile : tiles)
+			for(const std::pair<uint32_t, uint8_t> &marble : tile->outbox)
+				jump(marble.first, DIR_STAY, marble.first, marble.second);
+		return true;
+	#endif
+}
+
+void BoardCall::RunState::tile_jump(Tile &tile, uint32_t target, uint8_t value){
+	if(target < tile.first || target >= tile.last){
+		if(target != Board::ROUTE_DESTROYED)
+			tile.outbox.push_back({target, value});
+		return;
+	}
+	if(!next_marbles.has_marble(target))
+		track_marble(tile.live, target);
+	next_marbles.add_marble(target, value);
+	const Cell &cell = bc->board->cells[target];
+	if(cell.device == DV_TERMINATOR)
+		tile.terminated = true;
+	else if(cell.device == DV_OUTPUT)
+		tile.outputs_filled |= Board::output_bit(cell.value);
+}
+
+void BoardCall::RunState::write_stdout(uint8_t value){
+	if(captured_stdout){
+		captured_stdout->push_back(value);
 	}else{
-		process_boardcalls();
+		++bc->interpreter->stdout_bytes;
+		bc->interpreter->output->write(value);
 	}
-	// clear prepared/processed board calls
-	for(const auto rs : prepared_board_calls)
-		delete rs;
-	for(const auto rs : processed_board_calls)
-		delete rs;
-	prepared_board_calls.clear();
-	processed_board_calls.clear();
+}
+
+void BoardCall::RunState::capture_stdout(std::vector<uint8_t> *text){
+	captured_stdout = text;
+}
 
+uint64_t BoardCall::RunState::stdout_count() const {
+	return captured_stdout ? captured_stdout->size() : bc->interpreter->stdout_bytes;
+}
+
+bool BoardCall::RunState::mid_tick() const {
+	return in_tick;
+}
+
+void BoardCall::RunState::finish_tick(){
    	// movement through synchronisers and board calls cannot be 
    	// processed with only information about one marble
 	process_synchronisers();
+	const Settings &settings = bc->interpreter->settings;
+	Engine engine = settings.engine;
    	// deal with all other marbles
-   	for(uint16_t y = 0; y < bc->board->height; ++y){
-   		for(uint16_t x = 0; x < bc->board->width; ++x){
-   			uint32_t index = bc->board->index(x,y);
-   			const Cell &cell = bc->board->cells[index];
-   			if(!is_empty_cell(cur_marbles[index])){
-   				process_cell(x, y, cell);
-   			}
-   		}
-   	}
+	if(engine == ENGINE_BYTECODE || engine == ENGINE_TILES){
+		std::sort(cur_live.cells.begin(), cur_live.cells.end());
+		if(engine == ENGINE_BYTECODE || !run_tiles())
+			run_program(cur_live.cells.data(), cur_live.cells.data() + cur_live.cells.size(), nullptr);
+	}else if(engine == ENGINE_SPARSE){
+		std::sort(cur_live.cells.begin(), cur_live.cells.end());
+		for(uint32_t index : cur_live.cells)
+			process_cell(index, bc->board->cells[index]);
+	}else{
+		// visit occupied cells in row-major order, skipping 64 empty cells at a time
+		for(uint32_t word = 0, words = MarbleGrid::words(bc->board->cells.size()); word < words; ++word){
+			uint64_t bits = cur_marbles.occupied[word];
+			#if VMARBELOUS == 0
+				// vmarbelous needs every marble in moved_marbles to animate it
+				if(uint64_t falling = bits & bc->board->fall_mask[word]){
+					fall(64 * word, falling);
+					bits &= ~falling;
+					marbles_moved = true;
+				}
+			#endif
+			for(; bits; bits &= bits - 1){
+				uint32_t index = 64 * word + lowest_bit(bits);
+				process_cell(index, bc->board->cells[index]);
+			}
+		}
+	}
 	// next -> cur
 	std::swap(cur_marbles, next_marbles);
-	std::fill(next_marbles.begin(), next_marbles.end(), 0);
+	cur_hash = next_hash;
+	next_hash = 0;
+	if(tracks_occupancy){
+		// only clear the words that held marbles
+		for(uint32_t index : cur_live.cells)
+			next_marbles.occupied[index / 64] = 0;
+		std::swap(cur_live, next_live);
+		next_live.cells.clear();
+		next_live.board_calls.clear();
+		next_live.synchronisers = 0;
+	}else{
+		next_marbles.clear(bc->board->cells.size());
+		std::swap(cur_live.board_calls, next_live.board_calls);
+		next_live.board_calls.clear();
+	}
 	// output stdout
-	for(int i = 0; i < bc->board->width; ++i){
-		if(!is_empty_cell(stdout_values[i])){
-			stdout_write(stdout_values[i]);
-			stdout_text.push_back(stdout_values[i] & 255);
+	if(tracks_occupancy){
+		std::sort(stdout_columns.begin(), stdout_columns.end());
+		for(uint16_t i : stdout_columns){
+			write_stdout(stdout_values[i]);
+			if(settings.verbosity > 1)
+				stdout_text.push_back(stdout_values[i] & 255);
 			stdout_values[i] = 0;
 		}
+		stdout_columns.clear();
+	}else{
+		for(int i = 0; i < bc->board->width; ++i){
+			if(!is_empty_cell(stdout_values[i])){
+				write_stdout(stdout_values[i]);
+				if(settings.verbosity > 1)
+					stdout_text.push_back(stdout_values[i] & 255);
+				stdout_values[i] = 0;
+			}
+		}
 	}
+	if(!captured_stdout)
+		bc->interpreter->output->flush_if_due();
 	++tick_number;
-	if(verbosity > 2)
+	if(settings.verbosity > 2)
 		output_board();
-	
-	return !is_finished();
 }
 
 void BoardCall::RunState::finalize(){
@@ -155,7 +681,7 @@ void BoardCall::RunState::finalize(){
 		copy_output_helper(outputs[i], bc->board->outputs[i]);
 	copy_output_helper(output_left, bc->board->output_left);
 	copy_output_helper(output_right, bc->board->output_right);
-	if(verbosity > 1){
+	if(bc->interpreter->settings.verbosity > 1){
 		std::string indent = std::string(indents, ' ');
 		if(stdout_text.size() > 0){
 			std::printf("%sstdout_write STDOUT:", indent.c_str());
@@ -165,23 +691,39 @@ void BoardCall::RunState::finalize(){
 			std::fputc('\n', stdout);
 		}
 		std::printf("%sExiting board %s on tick %u due to ", indent.c_str(), bc->board->short_name.c_str(), tick_number);
-		if(terminator_reached)
-			std::puts("a filled terminator (!!) device");
-		else if(!marbles_moved)
-			std::puts("lack of activity");
-		else
-			std::puts("filled output devices");		
+		switch(exit_reason()){
+			case EXIT_TERMINATOR: std::puts("a filled terminator (!!) device"); break;
+			case EXIT_NO_ACTIVITY: std::puts("lack of activity"); break;
+			default: std::puts("filled output devices"); break;
+		}
 	}
 }
 
-bool BoardCall::RunState::is_finished(){
-	return !((!terminator_reached) &&
-	       (marbles_moved) &&
-	       (no_output || (
-	           std::find(outputs_filled.begin(), outputs_filled.end(), false) != outputs_filled.end() ||
-	           (!left_filled) ||
-	           (!right_filled)
-	       )));
+ExitReason BoardCall::RunState::exit_reason() const {
+	if(terminator_reached)
+		return EXIT_TERMINATOR;
+	if(!marbles_moved)
+		return EXIT_NO_ACTIVITY;
+	if(bc->board->required_outputs && outputs_filled == bc->board->required_outputs)
+		return EXIT_OUTPUTS_FILLED;
+	return EXIT_RUNNING;
+}
+
+void BoardCall::RunState::place_marble(uint32_t loc, uint8_t value){
+	if(!cur_marbles.has_marble(loc))
+		track_marble(cur_live, loc);
+	cur_marbles.add_marble(loc, value);
+}
+
+void BoardCall::RunState::track_marble(Occupancy &live, uint32_t loc){
+	const Cell &cell = bc->board->cells[loc];
+	if(cell.device == DV_BOARD)
+		live.board_calls.push_back(cell.board_call);
+	if(!tracks_occupancy)
+		return;
+	live.cells.push_back(loc);
+	if(cell.device == DV_SYNCHRONISER)
+		live.synchronisers |= UINT64_C(1) << cell.value;
 }
 
 void BoardCall::RunState::output_board(){
@@ -191,8 +733,8 @@ void BoardCall::RunState::output_board(){
 		std::fputs(indent.c_str(), stdout);
 		for(int x = 0; x < bc->board->width; ++x){
 			uint32_t loc = bc->board->index(x, y);
-			if(!is_empty_cell(cur_marbles[loc])){
-				std::printf("%02X ", cur_marbles[loc] & 255);
+			if(cur_marbles.has_marble(loc)){
+				std::printf("%02X ", cur_marbles.values[loc]);
 			}else{
 				uint8_t raw_value = bc->board->cells[loc].value;
 				char value = '#';
@@ -254,138 +796,146 @@ void BoardCall::RunState::copy_output_helper(uint16_t &output,
 		output = 0;
 		bool filled = false;
 		for(uint32_t loc : output_locs)
-			if(!is_empty_cell(cur_marbles[loc]))
-				output = (output + cur_marbles[loc]) & 0xFF, filled = true;
+			if(cur_marbles.has_marble(loc))
+				output = (output + cur_marbles.values[loc]) & 0xFF, filled = true;
 		output |= 0xFF00;
 		if(!filled)
 			output = 0;
 	}
 }
 void BoardCall::RunState::set_marble(uint32_t loc,
-                                     int32_t x_disp, 
-                                     int32_t y_disp,
+                                     Direction dir,
                                      uint16_t value){
-	uint16_t x, y;
-	y = loc / bc->board->width;
-	x = loc % bc->board->width;
-
+	jump(loc, dir, bc->board->route(loc, dir), value);
+}
+void BoardCall::RunState::jump(uint32_t loc,
+                               Direction dir,
+                               uint32_t target,
+                               uint16_t value){
 	#if VMARBELOUS == 1
-		if((!x_disp || !y_disp) && (y_disp <= 1 && x_disp >= -1 && x_disp <= 1)){
-			uint16_t dir_mask;
-			if(y_disp == 1)
-				dir_mask = 0x0300;
-			else if(x_disp == 1)
-				dir_mask = 0x0200;
-			else if(x_disp == -1)
-				dir_mask = 0x0100;
-			else
-				dir_mask = 0x0000;
-			moved_marbles.push_back({dir_mask | (value & 255), loc});
-		}
+		moved_marbles.push_back({static_cast<uint16_t>((dir << 8) | (value & 255)), loc});
+	#else
+		(void) dir;
 	#endif
 
-	if(x + x_disp >= bc->board->width || x + x_disp < 0){
-		if(cylindrical){
-			if(x + x_disp >= bc->board->width){
-				x = 0;
-			}else{
-				x = bc->board->width - 1;
-			}
-			x_disp = 0;
-		}else{
-			return;
+	loc = target;
+	if(loc >= Board::ROUTE_STDOUT){
+		if(loc != Board::ROUTE_DESTROYED){
+			uint16_t x = loc & ~Board::ROUTE_STDOUT;
+			if(tracks_occupancy && is_empty_cell(stdout_values[x]))
+				stdout_columns.push_back(x);
+			stdout_values[x] = value | 0xFF00;
 		}
-	}
-	if(y + y_disp < 0){
-		emit_warning("Displacement of marble over top of board; this should never happen");
-		return;
-	}
-	if(y + y_disp >= bc->board->height){
-		stdout_values[x] = value | 0xFF00;
 		return;
 	}
 
-
-	loc = bc->board->index(x + x_disp, y + y_disp);
-	next_marbles[loc] = ((next_marbles[loc] + value) & 255) | 0xFF00;
+	if(!next_marbles.has_marble(loc))
+		track_marble(next_live, loc);
+	merge_marble(loc, value);
 
 	if(bc->board->cells[loc].device == DV_TERMINATOR){
 		terminator_reached = true;
 	}else if(bc->board->cells[loc].device == DV_OUTPUT){
-		switch(bc->board->cells[loc].value){
-			case 255: // left output
-				left_filled = true;
-			break;
-			case 254: // right output
-				right_filled = true;
-			break;
-			default: // value = n in {n	
-				outputs_filled[bc->board->cells[loc].value] = true;
-		}
+		outputs_filled |= Board::output_bit(bc->board->cells[loc].value);
+	}
+}
+void BoardCall::RunState::merge_marble(uint32_t loc, uint8_t value){
+	if(!cycle.armed){
+		next_marbles.add_marble(loc, value);
+		return;
 	}
+	if(next_marbles.has_marble(loc))
+		next_hash ^= marble_hash(loc, next_marbles.values[loc]);
+	next_marbles.add_marble(loc, value);
+	next_hash ^= marble_hash(loc, next_marbles.values[loc]);
 }
 void BoardCall::RunState::process_synchronisers(){
 	for(int i = 0; i < 36; ++i){
+		// groups without marbles have nothing to move
+		if(tracks_occupancy && !(cur_live.synchronisers & (UINT64_C(1) << i)))
+			continue;
 		bool allSet = true;
 		for(uint32_t loc : bc->board->synchronisers[i])
-			allSet &= !is_empty_cell(cur_marbles[loc]);
+			allSet &= cur_marbles.has_marble(loc);
 		if(allSet){
 			for(uint32_t loc : bc->board->synchronisers[i]){
 				// move down a row
-				set_marble(loc, 0, 1, cur_marbles[loc]);
+				set_marble(loc, DIR_DOWN, cur_marbles.values[loc]);
 				marbles_moved = true;
 			}
 		}else{
 			for(uint32_t loc : bc->board->synchronisers[i]){
-				if(!is_empty_cell(cur_marbles[loc]))
-					set_marble(loc, 0, 0, cur_marbles[loc]);
+				if(cur_marbles.has_marble(loc))
+					set_marble(loc, DIR_STAY, cur_marbles.values[loc]);
 			}
 		}
 	}
 }
-void BoardCall::RunState::process_boardcalls(){
-	for(const auto &board_call : bc->board->board_calls){
-		uint32_t loc = bc->board->index(board_call.x, board_call.y);
-		bool canCall = true;
-		for(int i = 0; i < board_call.board->length; ++i)
-			if(!board_call.board->inputs[i].empty() && is_empty_cell(cur_marbles[loc + i])){
-				canCall = false;
-				break;
-			}
-		if(!canCall){
-			for(uint32_t i = loc, end = loc + board_call.board->length; i < end; ++i){
-				if(!is_empty_cell(cur_marbles[i]))
-					set_marble(i, 0, 0, cur_marbles[i]);
-			}
-		}else{
-			uint8_t inputs[36] = { };
-			for(int i = 0; i < board_call.board->length; ++i)
-				inputs[i] = cur_marbles[loc + i] & 0xFF;
-			RunState *rs = board_call.call(inputs, indents + 1);
-			for(int i = 0; i < board_call.board->length; ++i)
-				if(!is_empty_cell(rs->outputs[i]))
-					set_marble(loc + i, 0, 1, rs->outputs[i]);
-			if(!is_empty_cell(rs->output_left))
-				set_marble(loc, -1, 0, rs->output_left);
-			if(!is_empty_cell(rs->output_right))
-				set_marble(loc + (board_call.board->length - 1), 1, 0, rs->output_right);
-			marbles_moved = true;
-			delete rs;
+bool BoardCall::RunState::call_ready(const BoardCall &board_call) const {
+	uint32_t loc = bc->board->index(board_call.x, board_call.y);
+	for(int i = 0; i < board_call.board->length; ++i)
+		if(!board_call.board->inputs[i].empty() && !cur_marbles.has_marble(loc + i))
+			return false;
+	return true;
+}
+BoardCall::RunState *BoardCall::RunState::process_boardcall(const BoardCall &board_call){
+	uint32_t loc = bc->board->index(board_call.x, board_call.y);
+	if(!call_ready(board_call)){
+		for(uint32_t i = loc, end = loc + board_call.board->length; i < end; ++i){
+			if(cur_marbles.has_marble(i))
+				set_marble(i, DIR_STAY, cur_marbles.values[i]);
+		}
+		return nullptr;
+	}
+	uint8_t inputs[36] = { };
+	for(int i = 0; i < board_call.board->length; ++i)
+		inputs[i] = cur_marbles.values[loc + i];
+	// calls to pure boards only depend on their inputs
+	// (traces printed by verbose modes would be skipped, so don't cache then)
+	Interpreter &interpreter = *bc->interpreter;
+	running_call_cacheable = board_call.board->pure && interpreter.call_cache.enabled()
+	                         && interpreter.settings.verbosity < 2;
+	if(running_call_cacheable){
+		CallResult result;
+		if(interpreter.call_cache.find(board_call.board, inputs, result)){
+			apply_call_outputs(board_call, result.outputs, result.output_left, result.output_right);
+			return nullptr;
 		}
+		std::copy(inputs, inputs + 36, running_call_inputs);
 	}
+	// the caller runs the new board and passes it back to resume()
+	RunState *rs = board_call.new_run_state(inputs, indents + 1);
+	rs->captured_stdout = captured_stdout;
+	// pure boards don't use randomness; not splitting for them keeps the sequence
+	// of this board the same whether or not the call was cached
+	if(!board_call.board->pure)
+		rs->random = random.split();
+	return rs;
+}
+void BoardCall::RunState::apply_call_outputs(const BoardCall &board_call,
+                                             const uint16_t outputs[],
+                                             uint16_t output_left,
+                                             uint16_t output_right){
+	uint32_t loc = bc->board->index(board_call.x, board_call.y);
+	for(int i = 0; i < board_call.board->length; ++i)
+		if(!is_empty_cell(outputs[i]))
+			set_marble(loc + i, DIR_DOWN, outputs[i]);
+	if(!is_empty_cell(output_left))
+		set_marble(loc, DIR_LEFT, output_left);
+	if(!is_empty_cell(output_right))
+		set_marble(loc + (board_call.board->length - 1), DIR_RIGHT, output_right);
+	marbles_moved = true;
 }
-void BoardCall::RunState::process_cell(uint16_t x,
-                                       uint16_t y,
+void BoardCall::RunState::process_cell(uint32_t loc,
                                        const Cell &cell){
-	uint32_t loc = bc->board->index(x, y);
-	uint16_t value = cur_marbles[loc] & 255;
+	uint16_t value = cur_marbles.values[loc];
 	switch(cell.device){
 		case DV_LEFT_DEFLECTOR: 
-			set_marble(loc, -1, 0, value);
+			set_marble(loc, DIR_LEFT, value);
 			marbles_moved = true;
 		break;
 		case DV_RIGHT_DEFLECTOR: 
-			set_marble(loc, +1, 0, value);
+			set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_PORTAL:
@@ -398,80 +948,80 @@ void BoardCall::RunState::process_cell(uint16_t x,
 			}else{
 				// cannot exit out of entrance portal unless only 1 portal
 				// if out_loc >= current index, add 1
-				int out_portal = std::rand() % (portals.size() - 1); 
+				int out_portal = random.below(portals.size() - 1);
 				if(out_portal >= std::distance(portals.begin(), std::find(portals.begin(), portals.end(), loc))){
 					++out_portal;
 				}
 				out_loc = portals[out_portal];
 			}
-			set_marble(out_loc, 0, +1, value);
+			set_marble(out_loc, DIR_DOWN, value);
 			marbles_moved = true;
 		}
 		break;
 		case DV_EQUALS: 
 			if(value == cell.value)
-				set_marble(loc, 0, +1, value);
+				set_marble(loc, DIR_DOWN, value);
 			else
-				set_marble(loc, +1, 0, value);
+				set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_GREATER_THAN:
 			if(value > cell.value)
-				set_marble(loc, 0, +1, value);
+				set_marble(loc, DIR_DOWN, value);
 			else
-				set_marble(loc, +1, 0, value);
+				set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_LESS_THAN:
 			if(value < cell.value)
-				set_marble(loc, 0, +1, value);
+				set_marble(loc, DIR_DOWN, value);
 			else
-				set_marble(loc, +1, 0, value);
+				set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_ADDER:
 		case DV_INCREMENTOR:
-			set_marble(loc, 0, +1, value + cell.value);
+			set_marble(loc, DIR_DOWN, value + cell.value);
 			marbles_moved = true;
 		break;
 		case DV_SUBTRACTOR:
 		case DV_DECREMENTOR:
-			set_marble(loc, 0, 1, value - cell.value);
+			set_marble(loc, DIR_DOWN, value - cell.value);
 			marbles_moved = true;
 		break;
 		case DV_BIT_CHECKER:
-			set_marble(loc, 0, +1, !!(value & (1 << cell.value)));
+			set_marble(loc, DIR_DOWN, cell.value < 8 ? (value >> cell.value) & 1 : 0);
 			marbles_moved = true;
 		break;
 		case DV_LEFT_BIT_SHIFTER:
-			set_marble(loc, 0, +1, value << 1);
+			set_marble(loc, DIR_DOWN, value << 1);
 			marbles_moved = true;
 		break;
 		case DV_RIGHT_BIT_SHIFTER:
-			set_marble(loc, 0, +1, value >> 1);
+			set_marble(loc, DIR_DOWN, value >> 1);
 			marbles_moved = true;
 		break;
 		case DV_BINARY_NOT:
-			set_marble(loc, 0, +1, ~value);
+			set_marble(loc, DIR_DOWN, ~value);
 			marbles_moved = true;
 		break;
 		case DV_STDIN:
-			if(stdin_available())
-				set_marble(loc, 0, +1, stdin_get());
+			if(bc->interpreter->input->available())
+				set_marble(loc, DIR_DOWN, bc->interpreter->input->get());
 			else
-				set_marble(loc, +1, 0, value);
+				set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_OUTPUT:
-			set_marble(loc, 0, 0, value);
+			set_marble(loc, DIR_STAY, value);
 		break;
 		case DV_TRASH_BIN:
 			// marbles are to be removed, do nothing
 			marbles_moved = true;
 		break;
 		case DV_CLONER:
-			set_marble(loc, -1, 0, value);
-			set_marble(loc, +1, 0, value);
+			set_marble(loc, DIR_LEFT, value);
+			set_marble(loc, DIR_RIGHT, value);
 			marbles_moved = true;
 		break;
 		case DV_TERMINATOR:
@@ -479,14 +1029,14 @@ void BoardCall::RunState::process_cell(uint16_t x,
 		break;
 		case DV_RANDOM:
 			if(cell.value == 253) // ?? device
-				set_marble(loc, 0, +1, std::rand() % (value + 1u));
+				set_marble(loc, DIR_DOWN, random.below(value + 1u));
 			else // ?n device
-				set_marble(loc, 0, +1, std::rand() % (cell.value + 1));
+				set_marble(loc, DIR_DOWN, random.below(cell.value + 1));
 			marbles_moved = true;
 		break;
 		case DV_BLANK:
 		case DV_INPUT:
-			set_marble(loc, 0, +1, value);
+			set_marble(loc, DIR_DOWN, value);
 			marbles_moved = true;
 		break;
 		default: 
@@ -495,7 +1045,148 @@ void BoardCall::RunState::process_cell(uint16_t x,
 	}
 }
 
-void Board::initialize(){
+void BoardCall::RunState::fall(uint32_t loc, uint64_t cells){
+	uint32_t width = bc->board->width;
+	#if VMARBELOUS == 0 && (defined(__AVX2__) || defined(__SSE2__))
+		if(!cycle.armed){
+			// merge values a vector at a time; falling cells never share a destination, so
+			// only marbles already on next_marbles have to be taken into account
+			uint32_t words = MarbleGrid::words(bc->board->cells.size());
+			for(uint32_t lane = 0; lane < 64; lane += FALL_LANES){
+				uint32_t falling = static_cast<uint32_t>(cells >> lane) & static_cast<uint32_t>((UINT64_C(1) << FALL_LANES) - 1);
+				if(!falling)
+					continue;
+				uint32_t occupied = extract_bits(next_marbles.occupied, words, loc + lane + width, FALL_LANES);
+				merge_lanes(cur_marbles.values + loc + lane, next_marbles.values + loc + lane + width, falling, occupied);
+			}
+			// then mark the destinations as occupied, which are the cells shifted by a row
+			uint32_t dest = loc + width;
+			next_marbles.occupied[dest / 64] |= cells << (dest % 64);
+			if(dest % 64 && cells >> (64 - dest % 64))
+				next_marbles.occupied[dest / 64 + 1] |= cells >> (64 - dest % 64);
+			return;
+		}
+	#endif
+	// one at a time, also while next_hash is kept
+	for(; cells; cells &= cells - 1){
+		uint32_t index = loc + lowest_bit(cells);
+		merge_marble(index + width, cur_marbles.values[index]);
+	}
+}
+
+void BoardCall::RunState::run_program(const uint32_t *begin, const uint32_t *end, Tile *tile){
+	const Board &board = *bc->board;
+	// bands running side by side only touch their tile, and report back through it
+	bool moved = false, terminated = false;
+	auto move = [this, tile](uint32_t loc, Direction dir, uint32_t target, uint8_t value){
+		if(tile)
+			tile_jump(*tile, target, value);
+		else
+			jump(loc, dir, target, value);
+	};
+	for(const uint32_t *live = begin; live != end; ++live){
+		uint32_t loc = *live;
+		uint8_t value = cur_marbles.values[loc];
+		uint32_t pc = board.program_index[loc];
+		if(pc == Board::PROGRAM_FALL){
+			move(loc, DIR_DOWN, board.route(loc, DIR_DOWN), value);
+			moved = true;
+			continue;
+		}
+		const Instruction &ins = board.program[pc];
+		switch(ins.opcode){
+			case OP_MOVE:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], value);
+				moved = true;
+			break;
+			case OP_STAY:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], value);
+			break;
+			case OP_PORTAL:
+			{
+				// cannot exit out of entrance portal
+				const auto &portals = board.portals[ins.value];
+				uint32_t out_portal = random.below(portals.size() - 1);
+				if(out_portal >= ins.targets[1])
+					++out_portal;
+				uint32_t out_loc = portals[out_portal];
+				move(out_loc, DIR_DOWN, board.route(out_loc, DIR_DOWN), value);
+				moved = true;
+			}
+			break;
+			case OP_EQUALS:
+				move(loc, Direction(ins.dirs[value != ins.value]), ins.targets[value != ins.value], value);
+				moved = true;
+			break;
+			case OP_GREATER_THAN:
+				move(loc, Direction(ins.dirs[value <= ins.value]), ins.targets[value <= ins.value], value);
+				moved = true;
+			break;
+			case OP_LESS_THAN:
+				move(loc, Direction(ins.dirs[value >= ins.value]), ins.targets[value >= ins.value], value);
+				moved = true;
+			break;
+			case OP_ADD:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], static_cast<uint8_t>(value + ins.value));
+				moved = true;
+			break;
+			case OP_BIT_CHECK:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], ins.value < 8 ? (value >> ins.value) & 1 : 0);
+				moved = true;
+			break;
+			case OP_SHIFT_LEFT:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], static_cast<uint8_t>(value << 1));
+				moved = true;
+			break;
+			case OP_SHIFT_RIGHT:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], value >> 1);
+				moved = true;
+			break;
+			case OP_NOT:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], static_cast<uint8_t>(~value));
+				moved = true;
+			break;
+			case OP_STDIN:
+				if(bc->interpreter->input->available())
+					move(loc, Direction(ins.dirs[0]), ins.targets[0], bc->interpreter->input->get());
+				else
+					move(loc, Direction(ins.dirs[1]), ins.targets[1], value);
+				moved = true;
+			break;
+			case OP_TRASH:
+				moved = true;
+			break;
+			case OP_CLONE:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], value);
+				move(loc, Direction(ins.dirs[1]), ins.targets[1], value);
+				moved = true;
+			break;
+			case OP_TERMINATE:
+				terminated = true;
+			break;
+			case OP_RANDOM:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], random.below(ins.value + 1));
+				moved = true;
+			break;
+			case OP_RANDOM_MARBLE:
+				move(loc, Direction(ins.dirs[0]), ins.targets[0], random.below(value + 1u));
+				moved = true;
+			break;
+			default:
+				// processed separately, do nothing
+			break;
+		}
+	}
+	if(tile){
+		tile->moved |= moved;
+		tile->terminated |= terminated;
+	}else{
+		marbles_moved |= moved;
+		terminator_reached |= terminated;
+	}
+}
+
+void Board::initialize(bool cylindrical){
 	// get highest number input used
 	int highest_input = 0;
 	for(int i = 36; i --> 0;){
@@ -513,9 +1204,48 @@ void Board::initialize(){
 		}
 	}
 	length = std::max(1, std::max(highest_input, highest_output) + 1);
+	free_states.resize(workers.size());
 	// set actual_name
 	actual_name = "";
 	do actual_name += short_name; while(actual_name.length() < 2 * length);
 	actual_name = actual_name.substr(0, 2 * length);
+	// set routes
+	routes.resize(4 * static_cast<uint32_t>(width) * height);
+	for(uint16_t y = 0; y < height; ++y){
+		for(uint16_t x = 0; x < width; ++x){
+			uint32_t loc = index(x, y);
+			routes[4 * loc + DIR_STAY] = loc;
+			routes[4 * loc + DIR_DOWN] = (y + 1 < height) ? index(x, y + 1) : (ROUTE_STDOUT | x);
+			if(x > 0)
+				routes[4 * loc + DIR_LEFT] = loc - 1;
+			else
+				routes[4 * loc + DIR_LEFT] = cylindrical ? index(width - 1, y) : ROUTE_DESTROYED;
+			if(x + 1 < width)
+				routes[4 * loc + DIR_RIGHT] = loc + 1;
+			else
+				routes[4 * loc + DIR_RIGHT] = cylindrical ? index(0, y) : ROUTE_DESTROYED;
+		}
+	}
+	// cells whose order matters
+	ordered_cells = false;
+	for(const Cell &cell : cells)
+		if(cell.device == DV_STDIN || cell.device == DV_RANDOM)
+			ordered_cells = true;
+	for(const std::vector<uint32_t> &group : portals)
+		if(group.size() > 2)
+			ordered_cells = true;
+	// set required outputs
+	required_outputs = 0;
+	for(const Cell &cell : cells)
+		if(cell.device == DV_OUTPUT)
+			required_outputs |= output_bit(cell.value);
+	// set fall mask
+	fall_mask.assign(MarbleGrid::words(cells.size()), 0);
+	for(uint32_t loc = 0, end = cells.size(); loc + width < end; ++loc){
+		Device device = cells[loc].device, below = cells[loc + width].device;
+		if((device == DV_BLANK || device == DV_INPUT) && below != DV_TERMINATOR && below != DV_OUTPUT
+		   && below != DV_BOARD)
+			fall_mask[loc / 64] |= UINT64_C(1) << (loc % 64);
+	}
 }
 
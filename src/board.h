@@ -1,15 +1,69 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include "bytecode.h"
 #include "cell.h"
+#include "random.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <forward_list>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
 
 class Board;
+class Interpreter;
+
+// directions a marble can leave a cell in
+// values match the DD field of RunState::moved_marbles
+enum Direction{
+	DIR_STAY,
+	DIR_LEFT,
+	DIR_RIGHT,
+	DIR_DOWN,
+};
+
+// marbles on a board: a bitset of occupied cells (rows packed one after another, so
+// iterating over set bits visits cells in row-major order) and a plane of values
+// both point into storage owned by a RunState
+struct MarbleGrid{
+	uint64_t *occupied; // bit loc % 64 of word loc / 64 is set if cell loc holds a marble
+	uint8_t *values; // only meaningful for occupied cells
+
+	static inline uint32_t words(uint32_t cells){
+		return (cells + 63) / 64;
+	}
+	inline bool has_marble(uint32_t loc) const {
+		return (occupied[loc / 64] >> (loc % 64)) & 1;
+	}
+	// puts a marble on the cell, merging with any marble already there
+	inline void add_marble(uint32_t loc, uint8_t value){
+		uint64_t bit = UINT64_C(1) << (loc % 64);
+		if(occupied[loc / 64] & bit){
+			values[loc] += value;
+		}else{
+			occupied[loc / 64] |= bit;
+			values[loc] = value;
+		}
+	}
+	inline void remove_marble(uint32_t loc){
+		occupied[loc / 64] &= ~(UINT64_C(1) << (loc % 64));
+	}
+	// removes every marble; values are left as they are
+	inline void clear(uint32_t cells){
+		std::fill(occupied, occupied + words(cells), 0);
+	}
+};
+
+// why a board stopped running, see RunState::exit_reason()
+enum ExitReason{
+	EXIT_RUNNING, // not finished
+	EXIT_TERMINATOR, // a marble reached a terminator (!!)
+	EXIT_NO_ACTIVITY, // no marble moved during the last tick
+	EXIT_OUTPUTS_FILLED, // every output device of the board holds a marble
+};
 
 // list of locations on board calling
 struct BoardCall{
@@ -20,40 +74,58 @@ struct BoardCall{
 
 	// inputs: must be at least the length of the board; fill with anything if unused
 	// outputs, left_output, right_output: will be filled with 0x**XX if used (** nonzero)
+	// returns nullptr if the call exceeded the interpreter's max_depth or was stopped
+	// by --on-cycle=abort
 	static RunState *call(const BoardCall *bc, uint8_t inputs[], int indents = 0);
 
 	RunState *call(uint8_t inputs[], int indents = 0) const;
 		
 	RunState *new_run_state(uint8_t inputs[], int indents = 0) const;
+	// returns a runstate created by new_run_state to the pool of its board
+	static void recycle(RunState *rs);
 
 	Board *board;
 	uint16_t x, y; // location of first cell
+	// settings, I/O and caches the call runs with; set on every call by
+	// Interpreter::load and main_call
+	Interpreter *interpreter = nullptr;
 
 	struct RunState{
 		friend class BoardCall;
 
-		~RunState();
+		// runs the board and all board calls it makes until it finishes, then finalizes it
+		// returns false (after emitting an error) if calls nest deeper than max_depth
+		// or a board is stuck in a cycle under --on-cycle=abort
+		bool run();
 
-		// sets prepared_board_calls
-		// use process_boardcalls() instead if not concerned about debugging
-		void prepare_board_calls();
+		// advances the current tick up to the next board call that has to be run, and
+		// returns a new RunState for that call; pass it to resume() once it has finished
+		// returns nullptr once the tick is complete
+		RunState *step();
 
-		// copy over result of board calls
-		// does a tick. note: does not process board calls.
-		// returns true if board should not terminate after tick
-		// use_prepared: false if not using prepare_board_calls
-		bool tick(bool use_prepared = true);
+		// copies the outputs of a finished call returned by step() and deletes it
+		void resume(RunState *call);
+
+		// true if step() has started a tick without completing it
+		bool mid_tick() const;
 
 		// aggregates outputs to output fields
 		// call after board finishes.
-		// do not call if not using prepare_board_calls
 		void finalize();
 
 		// check if board has terminated
-		bool is_finished();
+		bool is_finished() const;
+		ExitReason exit_reason() const;
+
+		// places a marble on the current grid, merging with any marble already there
+		void place_marble(uint32_t loc, uint8_t value);
+
+		// collects stdout of the board and the calls it makes in text instead of
+		// writing it to the interpreter's output; call before run()
+		void capture_stdout(std::vector<uint8_t> *text);
 
-		std::vector<uint16_t> cur_marbles;
-		std::vector<uint16_t> next_marbles;
+		MarbleGrid cur_marbles;
+		MarbleGrid next_marbles;
 		std::vector<uint8_t> stdout_text; // only used for verbose modes
 		const BoardCall *bc;
 		unsigned tick_number = 0;
@@ -61,8 +133,8 @@ struct BoardCall{
 		uint16_t outputs[36] = { };
 		uint16_t output_left = 0, output_right = 0;
 
-		std::vector<RunState *> prepared_board_calls;
-		std::vector<RunState *> processed_board_calls;
+		// seeded by Interpreter::new_random in new_run_state; calls get a split of their caller's
+		Random random;
 
 		#if VMARBELOUS == 1
 			// stores marbles that didn't jump around
@@ -73,25 +145,125 @@ struct BoardCall{
 		#endif
 
 		private:
+			// occupancy words of cur_marbles and next_marbles, followed by their values
+			// and some padding for vector loads past the end of the board
+			std::vector<uint64_t> grids;
+
+			// cells, synchroniser groups and board calls holding marbles
+			// board calls are tracked by every engine, so that only calls with marbles on
+			// them are checked for inputs; the rest only by engines visiting occupied cells
+			struct Occupancy{
+				std::vector<uint32_t> cells;
+				std::vector<const BoardCall *> board_calls;
+				uint64_t synchronisers = 0; // bit n: group &n
+			};
+			Occupancy cur_live, next_live;
+			// the interpreter's engine only visits occupied cells, so cur_live.cells and
+			// stdout_columns are kept
+			bool tracks_occupancy = false;
+			std::vector<uint16_t> stdout_columns; // columns of stdout_values in use
+
+			// position of step() within the current tick
+			bool in_tick = false;
+			size_t next_live_call = 0; // index in cur_live.board_calls
+			// the call returned by step(), for caching its result
+			bool running_call_cacheable = false;
+			uint8_t running_call_inputs[36];
+
+			// calls run on the worker pool, see run_calls_in_parallel()
+			struct CallTask;
+			// stdout of a call run on the worker pool and the calls it makes, written
+			// out by the caller in call order; nullptr writes to the interpreter's output
+			std::vector<uint8_t> *captured_stdout = nullptr;
+			// indents of the board run() was first called on, for max_depth
+			int base_indents = 0;
+			// set when a call run on the worker pool failed; run() stops
+			bool call_failed = false;
+			// run() counting max_depth from base_indents
+			bool run(int base_indents);
+			// runs the ready board calls of the tick on the worker pool, each call on its
+			// own runstate, and applies their outputs in call order
+			// returns false without running any if they have to be run one at a time
+			bool run_calls_in_parallel();
+			bool call_ready(const BoardCall &board_call) const;
+			// writes to captured_stdout or the interpreter's output
+			void write_stdout(uint8_t value);
+			// characters written to stdout by this board and its calls, or by every board
+			uint64_t stdout_count() const;
+
+			// bands of cells processed on the worker pool by the tiles engine
+			struct Tile;
+			// processes the cells of the tick in bands on the worker pool, each band
+			// merging the marbles landing on its own cells; the others are applied in
+			// cell order once every band is done
+			// returns false without processing any if there are too few cells, or their
+			// order matters (see Board::ordered_cells)
+			bool run_tiles();
+			// jump() from a cell of tile
+			void tile_jump(Tile &tile, uint32_t target, uint8_t value);
+
 			// internal states for when the board is running + not compiled
-			// _outputs_filled and _*_output are true when output is filled or doesn't exist
-			// outputs_filled and *_output are not true when the output does not exist
 			bool marbles_moved = true, terminator_reached = false;
-			std::vector<bool> outputs_filled = std::vector<bool>(36);
-			bool left_filled = false, right_filled = false;
+			uint64_t outputs_filled = 0; // Board::output_bit of each output holding a marble
 			std::vector<uint16_t> stdout_values;
-			bool no_output = false; // exit if no outputs?
 			int indents = 0;
 
 			void output_board();
+			void track_marble(Occupancy &live, uint32_t loc);
 			void set_marble(uint32_t loc,
-			                int32_t x_disp,
-			                int32_t y_disp, 
+			                Direction dir,
 			                uint16_t value);
+			// set_marble with the route already looked up
+			void jump(uint32_t loc,
+			          Direction dir,
+			          uint32_t target,
+			          uint16_t value);
+			// next_marbles.add_marble, also updating next_hash
+			void merge_marble(uint32_t loc, uint8_t value);
+			// runs the compiled cells from begin to end; on a tile if not nullptr
+			void run_program(const uint32_t *begin, const uint32_t *end, Tile *tile);
+			// moves the marbles of the given cells down a row; loc: first cell of the word
+			// only for cells in Board::fall_mask
+			void fall(uint32_t loc, uint64_t cells);
 			void process_synchronisers();
-			void process_boardcalls();
-			void process_cell(uint16_t x,
-			                  uint16_t y,
+			// returns the RunState of the call if it has to be run
+			RunState *process_boardcall(const BoardCall &board_call);
+			// synchronisers, cells, stdout; everything after the board calls of a tick
+			void finish_tick();
+
+			// detects a board that keeps repeating the same ticks without reading stdin or
+			// writing stdout. if it checked stdin and found no input during them, waits for
+			// input instead of spinning; otherwise applies the --on-cycle policy
+			// cycles are found with Brent's algorithm on a hash of the board state, which
+			// snapshots of the state confirm
+			struct CycleCheck{
+				// the hashes below are only kept up to date while armed; armed by ticks
+				// finding no input on stdin, or always while report is set
+				bool armed = false;
+				// apply the --on-cycle policy; cleared after a warning
+				bool report = false;
+				bool have_saved = false;
+				uint64_t saved_hash = 0;
+				std::vector<uint64_t> saved, current;
+				unsigned power = 1, length = 0, saved_tick = 0;
+				// io counters at the start of the tick, and stdin misses when saved was taken
+				uint64_t stdin_reads = 0, stdout_bytes = 0, stdin_misses = 0, saved_misses = 0;
+				// set when the board is stuck under CYCLE_ABORT; run() stops
+				bool stuck = false;
+			};
+			CycleCheck cycle;
+			// Zobrist-style hashes of the marbles on cur_marbles and next_marbles
+			uint64_t cur_hash = 0, next_hash = 0;
+			void start_cycle_check();
+			void cycle_check();
+			void arm_cycle_check();
+			uint64_t state_hash() const;
+			void take_snapshot(std::vector<uint64_t> &snapshot) const;
+			void apply_call_outputs(const BoardCall &board_call,
+			                        const uint16_t outputs[],
+			                        uint16_t output_left,
+			                        uint16_t output_right);
+			void process_cell(uint32_t loc,
 			                  const Cell &cell);
 			void copy_output_helper(uint16_t &output,
 			                        const std::forward_list<uint32_t> &output_locs);
@@ -107,6 +279,8 @@ struct Board{
 
 	std::forward_list<uint32_t> output_left, output_right;
 	std::forward_list<BoardCall> board_calls;
+	// calls to boards without inputs; these are attempted every tick
+	std::vector<const BoardCall *> always_ready_calls;
 
 	uint16_t width, height;
 	uint8_t length;
@@ -115,12 +289,64 @@ struct Board{
 	std::string actual_name; // boardNameboardNameboardNa..
 	std::string short_name; // boardName
 
+	// Board::output_bit of every output device on the board; a board with outputs
+	// exits once all of them hold marbles
+	uint64_t required_outputs;
+	static inline uint64_t output_bit(uint8_t output){
+		// {0..{Z are bits 0-35, {< is bit 36 and {> is bit 37
+		return UINT64_C(1) << (output == 255 ? 36 : output == 254 ? 37 : output);
+	}
+
+	// finished runstates of calls to this board, reused by new_run_state
+	// one pool per worker thread (see WorkerPool::current), sized by initialize()
+	std::vector<std::vector<std::unique_ptr<BoardCall::RunState>>> free_states;
+
 	bool initialized;
+	// true if calls to this board only depend on their inputs: neither it nor any
+	// board it calls reads stdin, uses randomness or lets marbles fall off the bottom
+	bool pure;
+	// true if it or any board it calls has a stdin device; calls to such boards
+	// are never run on the worker pool, so that stdin is read in order
+	bool reads_stdin;
+	// true if it has stdin or random devices, or groups of more than two portals,
+	// whose results depend on the order its cells are processed in
+	bool ordered_cells;
+
+	// destination of a marble leaving each cell in each direction, see route()
+	// edges of the board are already resolved: ROUTE_STDOUT | x for marbles
+	// falling off the bottom in column x, ROUTE_DESTROYED for marbles falling
+	// off the sides of a non-cylindrical board
+	std::vector<uint32_t> routes;
+	static const uint32_t ROUTE_STDOUT = 0x80000000;
+	static const uint32_t ROUTE_DESTROYED = 0xFFFFFFFF;
+
+	// occupancy bits (see MarbleGrid) of cells where a marble just falls onto the cell
+	// below without any side effects: blank cells and inputs not on the bottom row
+	// and not above a terminator, output or board call; the scan engine moves these in bulk
+	std::vector<uint64_t> fall_mask;
 
-	void initialize();
+	// compiled cells for the bytecode engine, see compile()
+	// program_index maps each cell to its instruction; cells where marbles
+	// simply fall (blank cells and inputs) map to PROGRAM_FALL instead
+	std::vector<Instruction> program;
+	std::vector<uint32_t> program_index;
+	static const uint32_t PROGRAM_FALL = 0xFFFFFFFF;
+
+	// call after cells are loaded; routes off the sides wrap if cylindrical
+	void initialize(bool cylindrical);
+	// call after board calls are resolved
+	void compile();
 	inline uint32_t index(uint16_t x, uint16_t y) const {
 		return static_cast<uint32_t>(width) * y + x;
 	}
+	inline uint32_t route(uint32_t loc, Direction dir) const {
+		return routes[4 * loc + dir];
+	}
 };
 
+inline bool BoardCall::RunState::is_finished() const {
+	return terminator_reached || !marbles_moved ||
+	       (bc->board->required_outputs && outputs_filled == bc->board->required_outputs);
+}
+
 #endif // BOARD_H
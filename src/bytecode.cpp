@@ -0,0 +1,124 @@
+#include "board.h"
+#include "bytecode.h"
+#include "devices.h"
+
+#include <cstdint>
+#include <vector>
+
+static inline Instruction _make_instruction(Opcode opcode, uint8_t value = 0){
+	Instruction ins;
+	ins.opcode = opcode;
+	ins.value = value;
+	ins.dirs[0] = ins.dirs[1] = DIR_STAY;
+	ins.targets[0] = ins.targets[1] = Board::ROUTE_DESTROYED;
+	return ins;
+}
+static inline void _set_target(const Board &board, Instruction &ins, int slot, uint32_t loc, Direction dir){
+	ins.dirs[slot] = dir;
+	ins.targets[slot] = board.route(loc, dir);
+}
+
+void Board::compile(){
+	program.clear();
+	program_index.assign(cells.size(), PROGRAM_FALL);
+	for(uint32_t loc = 0, end = cells.size(); loc < end; ++loc){
+		const Cell &cell = cells[loc];
+		Instruction ins;
+		switch(cell.device){
+			case DV_BLANK:
+			case DV_INPUT:
+				// plain fall-through, handled without an instruction
+				continue;
+			case DV_LEFT_DEFLECTOR:
+				ins = _make_instruction(OP_MOVE);
+				_set_target(*this, ins, 0, loc, DIR_LEFT);
+			break;
+			case DV_RIGHT_DEFLECTOR:
+				ins = _make_instruction(OP_MOVE);
+				_set_target(*this, ins, 0, loc, DIR_RIGHT);
+			break;
+			case DV_PORTAL:
+				if(portals[cell.value].size() == 1){
+					// unpaired portal
+					ins = _make_instruction(OP_MOVE);
+					_set_target(*this, ins, 0, loc, DIR_DOWN);
+				}else{
+					ins = _make_instruction(OP_PORTAL, cell.value);
+					for(uint32_t i = 0; i < portals[cell.value].size(); ++i)
+						if(portals[cell.value][i] == loc)
+							ins.targets[1] = i;
+				}
+			break;
+			case DV_SYNCHRONISER:
+			case DV_BOARD:
+				ins = _make_instruction(OP_NOP);
+			break;
+			case DV_EQUALS:
+			case DV_GREATER_THAN:
+			case DV_LESS_THAN:
+				ins = _make_instruction(cell.device == DV_EQUALS ? OP_EQUALS :
+				                        cell.device == DV_GREATER_THAN ? OP_GREATER_THAN : OP_LESS_THAN,
+				                        cell.value);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+				_set_target(*this, ins, 1, loc, DIR_RIGHT);
+			break;
+			case DV_ADDER:
+			case DV_INCREMENTOR:
+				ins = _make_instruction(OP_ADD, cell.value);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_SUBTRACTOR:
+			case DV_DECREMENTOR:
+				ins = _make_instruction(OP_ADD, -cell.value);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_BIT_CHECKER:
+				ins = _make_instruction(OP_BIT_CHECK, cell.value);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_LEFT_BIT_SHIFTER:
+				ins = _make_instruction(OP_SHIFT_LEFT);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_RIGHT_BIT_SHIFTER:
+				ins = _make_instruction(OP_SHIFT_RIGHT);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_BINARY_NOT:
+				ins = _make_instruction(OP_NOT);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			case DV_STDIN:
+				ins = _make_instruction(OP_STDIN);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+				_set_target(*this, ins, 1, loc, DIR_RIGHT);
+			break;
+			case DV_OUTPUT:
+				ins = _make_instruction(OP_STAY);
+				_set_target(*this, ins, 0, loc, DIR_STAY);
+			break;
+			case DV_TRASH_BIN:
+				ins = _make_instruction(OP_TRASH);
+			break;
+			case DV_CLONER:
+				ins = _make_instruction(OP_CLONE);
+				_set_target(*this, ins, 0, loc, DIR_LEFT);
+				_set_target(*this, ins, 1, loc, DIR_RIGHT);
+			break;
+			case DV_TERMINATOR:
+				ins = _make_instruction(OP_TERMINATE);
+			break;
+			case DV_RANDOM:
+				if(cell.value == 253) // ?? device
+					ins = _make_instruction(OP_RANDOM_MARBLE);
+				else // ?n device
+					ins = _make_instruction(OP_RANDOM, cell.value);
+				_set_target(*this, ins, 0, loc, DIR_DOWN);
+			break;
+			default:
+				continue;
+		}
+		program_index[loc] = program.size();
+		program.push_back(ins);
+	}
+}
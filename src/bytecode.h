@@ -0,0 +1,36 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+
+// operations of compiled cells, see Board::compile()
+// targets are routes (see Board::route) computed when the board is compiled
+enum Opcode{
+	OP_MOVE, // move marble to targets[0]
+	OP_STAY, // keep marble in place without counting as motion (output devices)
+	OP_NOP, // synchronisers and board calls; processed separately
+	OP_PORTAL, // value: portal number, targets[1]: index in portal list
+	OP_EQUALS, // targets[0] if marble == value, otherwise targets[1]
+	OP_GREATER_THAN, // targets[0] if marble > value, otherwise targets[1]
+	OP_LESS_THAN, // targets[0] if marble < value, otherwise targets[1]
+	OP_ADD, // add value (mod 256), then move to targets[0]
+	OP_BIT_CHECK, // bit value of marble to targets[0]
+	OP_SHIFT_LEFT,
+	OP_SHIFT_RIGHT,
+	OP_NOT,
+	OP_STDIN, // byte from stdin to targets[0]; marble to targets[1] if none available
+	OP_TRASH,
+	OP_CLONE, // copies to targets[0] and targets[1]
+	OP_TERMINATE,
+	OP_RANDOM, // random value in [0, value] to targets[0]
+	OP_RANDOM_MARBLE, // random value in [0, marble] to targets[0]
+};
+
+struct Instruction{
+	uint8_t opcode;
+	uint8_t value; // immediate operand
+	uint8_t dirs[2]; // direction of each target; only used to animate in vmarbelous
+	uint32_t targets[2];
+};
+
+#endif // BYTECODE_H
@@ -7,3 +7,50 @@ const char *device_names[] = {
 
 	0
 };
+
+static CellToken _cell_tokens[1 << 16];
+const CellToken *const cell_tokens = _cell_tokens;
+
+static inline int _digit_value(char x){
+	if('0' <= x && x <= '9')
+		return x - '0';
+	if('A' <= x && x <= 'Z')
+		return x - 'A' + 10;
+	return -1;
+}
+static inline void _set_token(char first, char second, Device device, uint8_t value, bool marble = false){
+	_cell_tokens[static_cast<uint8_t>(first) | static_cast<uint8_t>(second) << 8] = CellToken{
+		static_cast<uint8_t>(device),
+		value,
+		marble
+	};
+}
+// adds a device spelled with first and second (a character or DIGIT_*)
+static inline void _add_spelling(Device device, char first, int second, uint8_t value){
+	if(second >= 0){
+		_set_token(first, second, device, value);
+		return;
+	}
+	int digits = second == DIGIT_BIT ? 8 : 36;
+	for(int digit = 0; digit < digits; ++digit)
+		_set_token(first, digit < 10 ? '0' + digit : 'A' + digit - 10, device, digit);
+}
+static bool _fill_cell_tokens(){
+	// anything else is part of a board call
+	for(CellToken &token : _cell_tokens)
+		token = CellToken{DV_BOARD, 0, false};
+	_set_token('.', '.', DV_BLANK, 0);
+	_set_token(' ', ' ', DV_BLANK, 0);
+	// marbles are written in hex; one digit at the end of a line counts as well
+	for(int high = 0; high < 16; ++high){
+		char first = high < 10 ? '0' + high : 'A' + high - 10;
+		_set_token(first, '\0', DV_BLANK, _digit_value(first), true);
+		for(int low = 0; low < 16; ++low)
+			_set_token(first, low < 10 ? '0' + low : 'A' + low - 10, DV_BLANK, 16 * high + low, true);
+	}
+	#define X(device_name, first, second, value) _add_spelling(DV_##device_name, first, second, value);
+		FOR_EACH_DEVICE_SPELLING(X)
+	#undef X
+	return true;
+}
+static const bool _cell_tokens_filled = _fill_cell_tokens();
@@ -1,6 +1,8 @@
 #ifndef DEVICES_H
 #define DEVICES_H
 
+#include <cstdint>
+
 // call(DEVICE_NAME)
 #define FOR_EACH_DEVICE(call) \
 	/* Flow Control */ \
@@ -35,6 +37,42 @@
 	call(BLANK) \
 	call(BOARD)
 
+// how devices are written
+// call(DEVICE_NAME, first character, second character, value)
+// a second character of DIGIT_BASE36 or DIGIT_BIT stands for any such digit, which
+// then is the value
+#define FOR_EACH_DEVICE_SPELLING(call) \
+	call(LEFT_DEFLECTOR, '/', '/', 0) \
+	call(RIGHT_DEFLECTOR, '\\', '\\', 0) \
+	call(PORTAL, '@', DIGIT_BASE36, 0) \
+	call(SYNCHRONISER, '&', DIGIT_BASE36, 0) \
+	call(EQUALS, '=', DIGIT_BASE36, 0) \
+	call(GREATER_THAN, '>', DIGIT_BASE36, 0) \
+	call(LESS_THAN, '<', DIGIT_BASE36, 0) \
+	call(ADDER, '+', DIGIT_BASE36, 0) \
+	call(SUBTRACTOR, '-', DIGIT_BASE36, 0) \
+	call(INCREMENTOR, '+', '+', 1) \
+	call(DECREMENTOR, '-', '-', 1) \
+	call(BIT_CHECKER, '^', DIGIT_BIT, 0) \
+	call(LEFT_BIT_SHIFTER, '<', '<', 0) \
+	call(RIGHT_BIT_SHIFTER, '>', '>', 0) \
+	call(BINARY_NOT, '~', '~', 0) \
+	call(STDIN, ']', ']', 0) \
+	call(INPUT, '}', DIGIT_BASE36, 0) \
+	call(OUTPUT, '{', DIGIT_BASE36, 0) \
+	call(OUTPUT, '{', '<', 255) \
+	call(OUTPUT, '{', '>', 254) \
+	call(TRASH_BIN, '\\', '/', 0) \
+	call(CLONER, '/', '\\', 0) \
+	call(TERMINATOR, '!', '!', 0) \
+	call(RANDOM, '?', DIGIT_BASE36, 0) \
+	call(RANDOM, '?', '?', 253)
+
+enum{
+	DIGIT_BASE36 = -1, // 0-9, A-Z
+	DIGIT_BIT = -2, // 0-7
+};
+
 enum Device{
 	#define X(device_name) DV_##device_name,
 		FOR_EACH_DEVICE(X)
@@ -44,4 +82,18 @@ enum Device{
 };
 extern const char *device_names[];
 
+// what the text of a cell stands for
+struct CellToken{
+	uint8_t device; // a Device; DV_BOARD for (part of) a board call
+	uint8_t value;
+	bool marble; // an initial marble of the given value on a blank cell
+};
+// every possible cell text, filled from FOR_EACH_DEVICE_SPELLING at startup
+// index: first character | second character << 8
+extern const CellToken *const cell_tokens;
+// second is '\0' for a cell of one character at the end of a line
+inline const CellToken &cell_token(char first, char second){
+	return cell_tokens[static_cast<uint8_t>(first) | static_cast<uint8_t>(second) << 8];
+}
+
 #endif // DEVICES_H
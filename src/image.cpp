@@ -0,0 +1,338 @@
+#include "board.h"
+#include "devices.h"
+#include "emit.h"
+#include "image.h"
+#include "load.h"
+#include "source_line.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+// layout, in native byte order (checked with IMAGE_BYTE_ORDER):
+// header: magic, version, byte order
+// sources: count, then path, size and hash of each (the first is the program)
+// boards: count, then for each board: width, height, full_name,
+//   short_name, device and value of each cell (0 for board calls), initial marbles,
+//   the inputs, outputs, synchronisers and portals of each digit, left and right
+//   outputs, and board calls as (board index, x, y)
+// purity is not stored, as it depends on --enable-cylindrical; see mark_pure_boards
+// lists are a count followed by their elements, in the order they are used
+// increase IMAGE_VERSION when this layout or the Device enum changes
+static const char IMAGE_MAGIC[8] = {'M', 'B', 'L', 'I', 'M', 'A', 'G', 'E'};
+static const uint32_t IMAGE_VERSION = 4;
+static const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+// appends values to the image
+class ImageWriter{
+	public:
+		template<typename T> void put(T value){
+			data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+		}
+		void put_string(const std::string &str){
+			put<uint32_t>(str.length());
+			data += str;
+		}
+		template<typename List> void put_list(const List &list){
+			put<uint32_t>(std::distance(list.begin(), list.end()));
+			for(uint32_t loc : list)
+				put<uint32_t>(loc);
+		}
+
+		std::string data;
+};
+
+// reads values from a mapped image; past the end, ok is cleared and zeroes are read
+class ImageReader{
+	public:
+		ImageReader(const char *data, size_t size): pos(data), end(data + size){}
+
+		template<typename T> T get(){
+			T value = T();
+			if(static_cast<size_t>(end - pos) < sizeof(T)){
+				ok = false;
+				return value;
+			}
+			std::memcpy(&value, pos, sizeof(T));
+			pos += sizeof(T);
+			return value;
+		}
+		std::string get_string(){
+			uint32_t length = get<uint32_t>();
+			if(static_cast<size_t>(end - pos) < length){
+				ok = false;
+				return "";
+			}
+			pos += length;
+			return std::string(pos - length, length);
+		}
+		// reads a list written by put_list into a std::forward_list or std::vector
+		// cells must be below cell_count
+		template<typename List> void get_list(List &list, uint32_t cell_count){
+			list.clear();
+			auto tail = list.before_begin();
+			for(uint32_t i = 0, count = get<uint32_t>(); i < count && ok; ++i){
+				uint32_t loc = get<uint32_t>();
+				ok &= loc < cell_count;
+				tail = list.insert_after(tail, loc);
+			}
+		}
+		void get_list(std::vector<uint32_t> &list, uint32_t cell_count){
+			list.clear();
+			for(uint32_t i = 0, count = get<uint32_t>(); i < count && ok; ++i){
+				list.push_back(get<uint32_t>());
+				ok &= list.back() < cell_count;
+			}
+		}
+
+		bool ok = true;
+	private:
+		const char *pos, *end;
+};
+
+bool write_image(const std::string &file,
+                 const std::deque<Board> &boards,
+                 const std::vector<SourceInfo> &sources){
+	ImageWriter image;
+	image.data.append(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	image.put<uint32_t>(IMAGE_VERSION);
+	image.put<uint32_t>(IMAGE_BYTE_ORDER);
+	image.put<uint32_t>(sources.size());
+	for(const SourceInfo &source : sources){
+		image.put_string(source.path);
+		image.put<uint64_t>(source.size);
+		image.put<uint64_t>(source.hash);
+	}
+	// only boards reachable from the main board; boards replaced by later
+	// definitions of the same name are never called
+	std::unordered_map<const Board *, uint32_t> indices;
+	std::vector<const Board *> reachable;
+	indices.emplace(&boards[0], 0);
+	reachable.push_back(&boards[0]);
+	for(size_t i = 0; i < reachable.size(); ++i){
+		for(const BoardCall &board_call : reachable[i]->board_calls){
+			if(indices.emplace(board_call.board, reachable.size()).second)
+				reachable.push_back(board_call.board);
+		}
+	}
+	image.put<uint32_t>(reachable.size());
+	for(const Board *called : reachable){
+		const Board &board = *called;
+		image.put<uint16_t>(board.width);
+		image.put<uint16_t>(board.height);
+		image.put_string(board.full_name);
+		image.put_string(board.short_name);
+		for(const Cell &cell : board.cells){
+			image.put<uint8_t>(cell.device);
+			image.put<uint8_t>(cell.device == DV_BOARD ? 0 : cell.value);
+		}
+		image.put<uint32_t>(std::distance(board.initial_marbles.begin(), board.initial_marbles.end()));
+		for(const auto &marble : board.initial_marbles){
+			image.put<uint32_t>(marble.first);
+			image.put<uint8_t>(marble.second);
+		}
+		for(int i = 0; i < 36; ++i){
+			image.put_list(board.inputs[i]);
+			image.put_list(board.outputs[i]);
+			image.put_list(board.synchronisers[i]);
+			image.put_list(board.portals[i]);
+		}
+		image.put_list(board.output_left);
+		image.put_list(board.output_right);
+		image.put<uint32_t>(std::distance(board.board_calls.begin(), board.board_calls.end()));
+		for(const BoardCall &board_call : board.board_calls){
+			image.put<uint32_t>(indices.at(board_call.board));
+			image.put<uint16_t>(board_call.x);
+			image.put<uint16_t>(board_call.y);
+		}
+	}
+
+	std::ofstream fs(file.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	fs.write(image.data.data(), image.data.size());
+	fs.close();
+	if(fs.fail()){
+		emit_error("Error writing to file `" + file + "`: `" + std::strerror(errno) + "`");
+		return false;
+	}
+	return true;
+}
+
+bool is_image(const std::string &file){
+	char magic[sizeof(IMAGE_MAGIC)];
+	std::ifstream fs(file.c_str(), std::ios_base::in | std::ios_base::binary);
+	return fs.read(magic, sizeof(magic)) && !std::memcmp(magic, IMAGE_MAGIC, sizeof(magic));
+}
+
+// list of board a cell belongs to, numbered as inputs, outputs, {<, {>,
+// synchronisers, portals; -1 for none
+static const int NO_LIST = -1;
+static inline int _cell_list(const Cell &cell){
+	switch(cell.device){
+		case DV_INPUT: return cell.value;
+		case DV_OUTPUT: return cell.value < 36 ? 36 + cell.value : cell.value == 255 ? 72 : 73;
+		case DV_SYNCHRONISER: return 74 + cell.value;
+		case DV_PORTAL: return 110 + cell.value;
+		default: return NO_LIST;
+	}
+}
+// true if the values of the cells are in range for their devices, and every cell
+// of an input, output, synchroniser or portal is in its list and nothing else is
+static inline bool _check_cells(const Board &board){
+	std::vector<int> lists(board.cells.size(), NO_LIST);
+	auto mark = [&lists](const std::forward_list<uint32_t> &list, int id){
+		for(uint32_t loc : list)
+			lists[loc] = id;
+	};
+	for(int i = 0; i < 36; ++i){
+		mark(board.inputs[i], i);
+		mark(board.outputs[i], 36 + i);
+		mark(board.synchronisers[i], 74 + i);
+		for(uint32_t loc : board.portals[i])
+			lists[loc] = 110 + i;
+	}
+	mark(board.output_left, 72);
+	mark(board.output_right, 73);
+	for(uint32_t loc = 0; loc < board.cells.size(); ++loc){
+		const Cell &cell = board.cells[loc];
+		bool in_range;
+		switch(cell.device){
+			case DV_INPUT:
+			case DV_SYNCHRONISER:
+			case DV_PORTAL: in_range = cell.value < 36; break;
+			case DV_OUTPUT: in_range = cell.value < 36 || cell.value >= 254; break;
+			case DV_BIT_CHECKER: in_range = cell.value < 8; break;
+			default: in_range = true; break;
+		}
+		if(!in_range || lists[loc] != _cell_list(cell))
+			return false;
+	}
+	return true;
+}
+
+// reads the boards of an image; false if it is corrupt
+static inline bool _read_boards(ImageReader &image, std::deque<Board> &boards, bool cylindrical){
+	uint32_t count = image.get<uint32_t>();
+	// board calls need the lengths of the boards they call, so they are linked last
+	std::vector<std::vector<std::pair<uint32_t, BoardCall>>> calls(count);
+	for(uint32_t id = 0; id < count && image.ok; ++id){
+		boards.resize(boards.size() + 1);
+		Board &board = boards.back();
+		board.width = image.get<uint16_t>();
+		board.height = image.get<uint16_t>();
+		board.full_name = image.get_string();
+		board.short_name = image.get_string();
+		uint32_t cell_count = static_cast<uint32_t>(board.width) * board.height;
+		board.cells.resize(cell_count);
+		for(Cell &cell : board.cells){
+			uint8_t device = image.get<uint8_t>(), value = image.get<uint8_t>();
+			image.ok &= device < DV_COUNT;
+			cell = Cell(static_cast<Device>(device), value);
+		}
+		auto tail = board.initial_marbles.before_begin();
+		for(uint32_t i = 0, marbles = image.get<uint32_t>(); i < marbles && image.ok; ++i){
+			uint32_t loc = image.get<uint32_t>();
+			image.ok &= loc < cell_count;
+			tail = board.initial_marbles.insert_after(tail, std::make_pair(loc, image.get<uint8_t>()));
+		}
+		for(int i = 0; i < 36; ++i){
+			image.get_list(board.inputs[i], cell_count);
+			image.get_list(board.outputs[i], cell_count);
+			image.get_list(board.synchronisers[i], cell_count);
+			image.get_list(board.portals[i], cell_count);
+		}
+		image.get_list(board.output_left, cell_count);
+		image.get_list(board.output_right, cell_count);
+		for(uint32_t i = 0, call_count = image.get<uint32_t>(); i < call_count && image.ok; ++i){
+			uint32_t index = image.get<uint32_t>();
+			uint16_t x = image.get<uint16_t>(), y = image.get<uint16_t>();
+			image.ok &= index < count && x < board.width && y < board.height;
+			calls[id].emplace_back(index, BoardCall(nullptr, x, y));
+		}
+		image.ok = image.ok && _check_cells(board);
+		if(image.ok)
+			board.initialize(cylindrical);
+	}
+	if(!image.ok)
+		return false;
+	for(uint32_t id = 0; id < count; ++id){
+		Board &board = boards[id];
+		// every board call cell is covered by exactly one call
+		std::vector<bool> linked(board.cells.size());
+		size_t unlinked = std::count_if(board.cells.begin(), board.cells.end(),
+		                                [](const Cell &cell){ return cell.device == DV_BOARD; });
+		auto tail = board.board_calls.before_begin();
+		for(auto &call : calls[id]){
+			call.second.board = &boards[call.first];
+			tail = board.board_calls.insert_after(tail, call.second);
+			if(tail->x + tail->board->length > board.width)
+				return false;
+			for(uint16_t x = tail->x; x < tail->x + tail->board->length; ++x){
+				uint32_t loc = board.index(x, tail->y);
+				if(board.cells[loc].device != DV_BOARD || linked[loc])
+					return false;
+				linked[loc] = true;
+				--unlinked;
+				board.cells[loc].board_call = &*tail;
+			}
+			bool has_inputs = false;
+			for(int i = 0; i < 36; ++i)
+				has_inputs |= !tail->board->inputs[i].empty();
+			if(!has_inputs)
+				board.always_ready_calls.push_back(&*tail);
+		}
+		if(unlinked)
+			return false;
+		board.compile();
+	}
+	// with the routes of this run
+	mark_pure_boards(boards);
+	return true;
+}
+
+bool load_image(const std::string &file, std::deque<Board> &boards, bool cylindrical){
+	// the image is read through a mapping, but its boards are copied into new Board
+	// objects rather than used in place
+	SourceFile mapped;
+	if(!mapped.open(file, false))
+		return false;
+	ImageReader image(mapped.get_text(), mapped.get_size());
+	image.get<uint64_t>(); // magic
+	uint32_t version = image.get<uint32_t>(), byte_order = image.get<uint32_t>();
+	if(version != IMAGE_VERSION || byte_order != IMAGE_BYTE_ORDER){
+		emit_error("Image " + file + " was written by a different version of marbelous or on a different "
+		           "platform; compile it again with --compile-to");
+		return false;
+	}
+	std::string program;
+	bool up_to_date = true;
+	for(uint32_t i = 0, count = image.get<uint32_t>(); i < count && image.ok; ++i){
+		SourceInfo info;
+		info.path = image.get_string();
+		info.size = image.get<uint64_t>();
+		info.hash = image.get<uint64_t>();
+		if(i == 0)
+			program = info.path;
+		if(!up_to_date || !image.ok)
+			continue;
+		// every source is hashed: sizes and modification times can stay the same
+		// when a file is edited or restored
+		SourceFile source;
+		if(!std::ifstream(info.path.c_str()) || !source.open(info.path, false)
+		   || source.get_size() != info.size || source.get_hash() != info.hash){
+			emit_warning("Image " + file + " is out of date: " + info.path + " has changed or is missing; loading "
+			             + program + " instead (compile it again with --compile-to)");
+			up_to_date = false;
+		}
+	}
+	if(image.ok && !up_to_date){
+		std::map<std::string, unsigned> lookup;
+		return load_mbl_file(program, boards, lookup, cylindrical);
+	}
+	if(!image.ok || !_read_boards(image, boards, cylindrical) || boards.empty()){
+		emit_error("Image " + file + " is corrupt");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,30 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "board.h"
+#include "load.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// compiled programs: the boards of a program after loading, with board calls
+// resolved to board indices, and the source files they were loaded from
+
+// writes the boards loaded by load_mbl_file from sources that can be reached from
+// the main board (boards[0]) to an image file
+// returns false (after emitting an error) if it cannot be written
+bool write_image(const std::string &file,
+                 const std::deque<Board> &boards,
+                 const std::vector<SourceInfo> &sources);
+
+// true if file is an image written by write_image
+bool is_image(const std::string &file);
+
+// loads the boards of an image; if any of its source files changed since it was
+// written, warns and loads the program from its sources instead
+// cylindrical: as passed to load_mbl_file
+// returns false (after emitting an error) if neither can be loaded
+bool load_image(const std::string &file, std::deque<Board> &boards, bool cylindrical);
+
+#endif // IMAGE_H
@@ -0,0 +1,93 @@
+#include "interpreter.h"
+#include "image.h"
+#include "io_functions.h"
+
+#include <map>
+#include <utility>
+
+bool ProcessInput::available(){
+	return _stdin_available();
+}
+
+uint8_t ProcessInput::get(){
+	return _stdin_get();
+}
+
+void ProcessInput::wait(){
+	stdin_wait();
+}
+
+uint64_t ProcessInput::miss_count() const {
+	return stdin_miss_count();
+}
+
+uint64_t ProcessInput::read_count() const {
+	return stdin_read_count();
+}
+
+void ProcessOutput::write(uint8_t value){
+	_stdout_write(value);
+}
+
+void ProcessOutput::flush(){
+	stdout_flush();
+}
+
+void ProcessOutput::flush_if_due(){
+	stdout_flush_if_due();
+}
+
+MemoryInput::MemoryInput(std::vector<uint8_t> bytes): bytes(std::move(bytes)){}
+
+bool MemoryInput::available(){
+	if(pos < bytes.size())
+		return true;
+	++misses;
+	return false;
+}
+
+uint8_t MemoryInput::get(){
+	// past the end of input, behave like getchar() returning EOF
+	return pos < bytes.size() ? bytes[pos++] : 0xFF;
+}
+
+void MemoryInput::wait(){
+	// all input there is has arrived
+}
+
+uint64_t MemoryInput::miss_count() const {
+	return misses;
+}
+
+uint64_t MemoryInput::read_count() const {
+	return pos;
+}
+
+void MemoryOutput::write(uint8_t value){
+	text.push_back(value);
+}
+
+Interpreter::Interpreter(): input(new ProcessInput), output(new ProcessOutput){}
+
+bool Interpreter::load(const std::string &file, std::vector<SourceInfo> *sources){
+	std::map<std::string, unsigned> lookup;
+	if(!(is_image(file) ? load_image(file, boards, settings.cylindrical)
+	                    : load_mbl_file(file, boards, lookup, settings.cylindrical, sources)))
+		return false;
+	for(Board &board : boards)
+		for(BoardCall &board_call : board.board_calls)
+			board_call.interpreter = this;
+	return true;
+}
+
+BoardCall Interpreter::main_call(){
+	BoardCall call(&boards[0], 0, 0);
+	call.interpreter = this;
+	return call;
+}
+
+Random Interpreter::new_random() const {
+	Random random;
+	random.seed(settings.random_seed);
+	return random;
+}
@@ -0,0 +1,142 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "board.h"
+#include "load.h"
+#include "memo.h"
+#include "random.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// tick engines; all produce identical results
+enum Engine{
+	ENGINE_SCAN, // visit every cell of the board each tick
+	ENGINE_SPARSE, // visit only cells holding marbles
+	ENGINE_BYTECODE, // like sparse, but run compiled boards instead of cells
+	// run --batch records side by side, see lanes.h; single runs and boards that
+	// cannot run on lanes use bytecode
+	ENGINE_LANES,
+	// like bytecode, but process the cells of large boards in bands on the worker pool
+	ENGINE_TILES,
+};
+
+// what to do when a board is found repeating the same ticks forever
+enum CyclePolicy{
+	CYCLE_IGNORE, // keep running
+	CYCLE_WARN, // emit a warning and keep running
+	CYCLE_ABORT, // exit with an error
+};
+
+// how an interpreter runs its program
+struct Settings{
+	int verbosity = 0; // traces printed while running, see -v
+	bool cylindrical = false; // used when the program is loaded
+	Engine engine = ENGINE_SCAN;
+	unsigned long max_depth = 0; // 0: unlimited
+	uint64_t random_seed = 0;
+	CyclePolicy on_cycle = CYCLE_IGNORE;
+	bool parallel_calls = false; // run the board calls of a tick on the worker pool
+};
+
+// where a program reads stdin from
+class InputSource{
+	public:
+		virtual ~InputSource() = default;
+		// true if a byte can be read without waiting
+		virtual bool available() = 0;
+		// the next byte, waiting for it; 0xFF past the end of input
+		virtual uint8_t get() = 0;
+		// blocks until there is input or it has ended
+		virtual void wait() = 0;
+		// number of available() calls that found no input, and of bytes read
+		virtual uint64_t miss_count() const = 0;
+		virtual uint64_t read_count() const = 0;
+};
+
+// where a program writes stdout to
+class OutputSink{
+	public:
+		virtual ~OutputSink() = default;
+		virtual void write(uint8_t value) = 0;
+		// writes out anything buffered
+		virtual void flush(){}
+		// flushes if the sink's flush interval has passed
+		virtual void flush_if_due(){}
+};
+
+// stdin and stdout of the process, see io_functions.h; interpreters using them
+// share the process's buffers
+class ProcessInput : public InputSource{
+	public:
+		bool available() override;
+		uint8_t get() override;
+		void wait() override;
+		uint64_t miss_count() const override;
+		uint64_t read_count() const override;
+};
+class ProcessOutput : public OutputSink{
+	public:
+		void write(uint8_t value) override;
+		void flush() override;
+		void flush_if_due() override;
+};
+
+// input given up front; ends after its last byte
+class MemoryInput : public InputSource{
+	public:
+		explicit MemoryInput(std::vector<uint8_t> bytes);
+		bool available() override;
+		uint8_t get() override;
+		void wait() override;
+		uint64_t miss_count() const override;
+		uint64_t read_count() const override;
+	private:
+		std::vector<uint8_t> bytes;
+		size_t pos = 0;
+		uint64_t misses = 0;
+};
+// output kept in memory
+class MemoryOutput : public OutputSink{
+	public:
+		std::vector<uint8_t> text;
+
+		void write(uint8_t value) override;
+};
+
+// a program and everything running it uses: settings, stdin and stdout, the call
+// cache and statistics. runstates reach it through their BoardCall, so separate
+// interpreters can run programs in the same process
+// the worker pool (see workers.h) is shared by all of them
+class Interpreter{
+	public:
+		// reads and writes the process's stdin and stdout
+		Interpreter();
+
+		Settings settings;
+		std::unique_ptr<InputSource> input;
+		std::unique_ptr<OutputSink> output;
+		// results of calls to pure boards
+		CallCache call_cache;
+
+		// the program; boards[0] is the main board (a deque, as board calls point to
+		// the boards they call)
+		std::deque<Board> boards;
+
+		// statistics
+		uint64_t stdout_bytes = 0; // characters written to output by all boards
+
+		// loads an image (see image.h) or a .mbl file and the files it includes, with
+		// settings.cylindrical; sources: as load_mbl_file, left empty for images
+		// returns false (after emitting an error) if it cannot be loaded
+		bool load(const std::string &file, std::vector<SourceInfo> *sources = nullptr);
+		// a call of the main board, to run the program with
+		BoardCall main_call();
+		// generator each runstate is seeded with; calls get a split of their caller's
+		Random new_random() const;
+};
+
+#endif // INTERPRETER_H
@@ -1,24 +1,39 @@
 #include "io_functions.h"
 
+#include <chrono>
 #include <cstdio>
 
 #if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
 	// unix-based systems: use pollfd, poll
 	#define UNIX 1
 	#include <sys/poll.h>
+	#include <termios.h>
+	#include <unistd.h>
 #elif defined(_WIN32)
 	// windows systems: use _kbhit
 	#include <Windows.h>
 	#include <conio.h>
+	#include <io.h>
 #else
 	#error "I/O for your OS is not supported, please see src/io_functions.cpp"
 #endif
 
+// stdin read-ahead buffer; refilled with one read when it runs out
+static uint8_t stdin_buffer[4096];
+static size_t stdin_pos = 0, stdin_len = 0;
+static bool stdin_eof = false;
+static bool stdin_is_terminal = false;
+static uint64_t stdin_misses = 0, stdin_reads = 0;
+
 // init = true for init, init = false for restore to original
 void prepare_io(bool init){
 	#if defined(UNIX)
 		static struct termios old_tio;
 		if(init){
+			// line input buffering only applies to terminals; leave pipes and files alone
+			stdin_is_terminal = isatty(STDIN_FILENO);
+			if(!stdin_is_terminal)
+				return;
 			// disable line input buffering
 			struct termios new_tio;
 			tcgetattr(STDIN_FILENO, &old_tio);
@@ -28,62 +43,155 @@ void prepare_io(bool init){
 			tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
 		}else{
 			// restore settings
-			tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+			stdout_flush();
+			if(stdin_is_terminal)
+				tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
 		}
 	#elif defined(_WIN32)
 		static DWORD mode;
 		auto stdin_handle = GetStdHandle(STD_INPUT_HANDLE);
 		if(init){
+			stdin_is_terminal = _isatty(_fileno(stdin));
+			if(!stdin_is_terminal)
+				return;
 			// diable line input buffering
 			GetConsoleMode(stdin_handle, &mode);
 			SetConsoleMode(stdin_handle, mode & ~ENABLE_LINE_INPUT);
 		}else{
 			// restore settings
-			SetConsoleMode(stdin_handle, mode);
+			stdout_flush();
+			if(stdin_is_terminal)
+				SetConsoleMode(stdin_handle, mode);
 		}
 	#endif
 }
 
-// pointers to allow changing function
-bool (*stdin_available)(void) = _stdin_available;
-uint8_t (*stdin_get)(void) = _stdin_get;
-void (*stdout_write)(uint8_t) = _stdout_write;
+// reads whatever stdin has ready into the empty read-ahead buffer
+// block: wait for input instead of returning if there is none
+static void _stdin_fill(bool block){
+	#if defined(UNIX)
+		if(!block){
+			struct pollfd fds;
+			fds.fd = 0; // stdin
+			fds.events = POLLIN;
+			if(poll(&fds, 1, 0) <= 0)
+				return;
+		}
+		ssize_t len = read(STDIN_FILENO, stdin_buffer, sizeof(stdin_buffer));
+		if(len <= 0)
+			stdin_eof = true;
+		else
+			stdin_pos = 0, stdin_len = len;
+	#elif defined(_WIN32)
+		if(stdin_is_terminal){
+			// consoles: characters as they are typed
+			if(!block && !_kbhit())
+				return;
+			stdin_buffer[0] = _getch();
+			stdin_pos = 0, stdin_len = 1;
+		}else{
+			size_t len = std::fread(stdin_buffer, 1, sizeof(stdin_buffer), stdin);
+			if(len == 0)
+				stdin_eof = true;
+			else
+				stdin_pos = 0, stdin_len = len;
+		}
+	#endif
+}
 
 // check if there is something to be read on stdin
 bool _stdin_available(){
-	#if defined(UNIX)
-		struct pollfd fds;
-		fds.fd = 0; // stdin
-		fds.event = POLLIN;
-		return poll(&fds, 1, 0);
-	#elif defined(_WIN32) 
-		return _kbhit();
-	#endif
+	if(stdin_pos < stdin_len)
+		return true;
+	if(stdin_eof)
+		return false;
+	// a program waiting for input may have printed a prompt
+	stdout_flush();
+	_stdin_fill(false);
+	if(stdin_pos < stdin_len)
+		return true;
+	++stdin_misses;
+	return false;
 }
 
 uint8_t _stdin_get(){
-	int ch;
-	#if defined(UNIX)
-		ch = getchar();
-	#elif defined(_WIN32)
-		ch = _getch();
-	#endif
-	return static_cast<uint8_t>(ch);
+	if(stdin_pos == stdin_len && !stdin_eof){
+		stdout_flush();
+		_stdin_fill(true);
+	}
+	// past the end of input, behave like getchar() returning EOF
+	if(stdin_pos == stdin_len)
+		return 0xFF;
+	++stdin_reads;
+	return stdin_buffer[stdin_pos++];
 }
 
-void _stdout_write(uint8_t value){
-	putchar(value);
+uint64_t stdin_miss_count(){
+	return stdin_misses;
 }
 
-static std::vector<uint8_t> stdout_save_vector;
-void _stdout_save(uint8_t value){
-	stdout_save_vector.push_back(value);
+uint64_t stdin_read_count(){
+	return stdin_reads;
+}
+
+void stdin_wait(){
+	if(stdin_pos < stdin_len || stdin_eof)
+		return;
+	stdout_flush();
+	_stdin_fill(true);
+}
+
+// stdout buffer, see stdout_configure
+static std::FILE *stdout_file = nullptr; // nullptr: stdout
+static std::vector<uint8_t> stdout_buffer;
+static size_t stdout_buffer_size = 0;
+static bool stdout_line_buffered = false;
+static std::chrono::steady_clock::duration stdout_flush_interval{0};
+static std::chrono::steady_clock::time_point stdout_last_flush;
+
+void _stdout_write(uint8_t value){
+	stdout_buffer.push_back(value);
+	if(stdout_buffer.size() >= stdout_buffer_size || (stdout_line_buffered && value == '\n'))
+		stdout_flush();
 }
 
 void _stdout_writehex(uint8_t value){
 	std::printf("0x%02X (%c) ", value, value);
 }
 
-const std::vector<uint8_t> &stdout_get_saved(){
-	return stdout_save_vector;
+bool stdout_configure(const char *file, size_t buffer_size, unsigned flush_interval){
+	stdout_flush();
+	if(stdout_file)
+		std::fclose(stdout_file);
+	stdout_file = nullptr;
+	if(file && *file){
+		stdout_file = std::fopen(file, "wb");
+		if(!stdout_file)
+			return false;
+	}
+	stdout_buffer_size = buffer_size;
+	stdout_buffer.reserve(buffer_size ? buffer_size : 1);
+	stdout_flush_interval = std::chrono::milliseconds(flush_interval);
+	#if defined(UNIX)
+		stdout_line_buffered = !stdout_file && isatty(STDOUT_FILENO);
+	#elif defined(_WIN32)
+		stdout_line_buffered = !stdout_file && _isatty(_fileno(stdout));
+	#endif
+	return true;
+}
+
+void stdout_flush(){
+	if(stdout_buffer.empty())
+		return;
+	stdout_last_flush = std::chrono::steady_clock::now();
+	std::FILE *out = stdout_file ? stdout_file : stdout;
+	std::fwrite(stdout_buffer.data(), 1, stdout_buffer.size(), out);
+	std::fflush(out);
+	stdout_buffer.clear();
+}
+
+void stdout_flush_if_due(){
+	if(!stdout_buffer.empty() && stdout_flush_interval.count() &&
+	   std::chrono::steady_clock::now() - stdout_last_flush >= stdout_flush_interval)
+		stdout_flush();
 }
@@ -1,27 +1,36 @@
 #ifndef IO_FUNCTIONS_H
 #define IO_FUNCTIONS_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 // init/cleans up io (init = false for cleanup)
 void prepare_io(bool init);
-// changeable function pointers..
-extern bool (*stdin_available)(void);
-extern uint8_t (*stdin_get)(void);
-extern void (*stdout_write)(uint8_t);
+// stdin and stdout of the process; programs use them through an Interpreter's
+// ProcessInput and ProcessOutput
 // check if any char is ready to be read on stdin
 bool _stdin_available();
 // get character from stdin
 uint8_t _stdin_get();
-// output character to stdout
+// number of _stdin_available() calls that found no input, and of characters read
+uint64_t stdin_miss_count();
+uint64_t stdin_read_count();
+// blocks until stdin has input or reaches its end
+void stdin_wait();
+// output character to stdout (through the stdout buffer)
 void _stdout_write(uint8_t value);
-// save stdout character instead of writing
-void _stdout_save(uint8_t value);
 // output character to stdout as hex
 void _stdout_writehex(uint8_t value);
 
-// get saved stdout characters
-const std::vector<uint8_t> &stdout_get_saved();
+// sets where and how _stdout_write writes; returns false if file cannot be opened
+// file: empty for stdout; buffer_size: bytes, 0 writes every byte at once
+// flush_interval: milliseconds before stdout_flush_if_due() writes out the buffer, 0 for never
+// output to a terminal is also flushed at every newline
+bool stdout_configure(const char *file, size_t buffer_size, unsigned flush_interval);
+// writes out buffered stdout characters
+void stdout_flush();
+// flushes if the flush interval has passed since the last flush
+void stdout_flush_if_due();
 
 #endif // IO_FUNCTIONS_H
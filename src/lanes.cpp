@@ -0,0 +1,617 @@
+#include "bits.h"
+#include "interpreter.h"
+#include "lanes.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+// calls nesting deeper than this run one lane at a time on runstates, which keep their
+// own stack instead of recursing
+static const unsigned MAX_LANE_NESTING = 256;
+
+// CHUNK lanes of values, operated on at once
+#if defined(__SSE2__)
+	static const int CHUNK = 16;
+	typedef __m128i Chunk;
+	static inline Chunk chunk_load(const uint8_t *p){
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	}
+	static inline void chunk_store(uint8_t *p, Chunk c){
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p), c);
+	}
+	static inline Chunk chunk_splat(uint8_t x){
+		return _mm_set1_epi8(static_cast<char>(x));
+	}
+	static inline Chunk chunk_add(Chunk a, Chunk b){
+		return _mm_add_epi8(a, b);
+	}
+	static inline Chunk chunk_sub(Chunk a, Chunk b){
+		return _mm_sub_epi8(a, b);
+	}
+	static inline Chunk chunk_and(Chunk a, Chunk b){
+		return _mm_and_si128(a, b);
+	}
+	static inline Chunk chunk_or(Chunk a, Chunk b){
+		return _mm_or_si128(a, b);
+	}
+	// a & ~b
+	static inline Chunk chunk_andnot(Chunk a, Chunk b){
+		return _mm_andnot_si128(b, a);
+	}
+	// 0xFF where a == b, 0x00 elsewhere
+	static inline Chunk chunk_eq(Chunk a, Chunk b){
+		return _mm_cmpeq_epi8(a, b);
+	}
+	// 0xFF where a > b (unsigned), 0x00 elsewhere
+	static inline Chunk chunk_gt(Chunk a, Chunk b){
+		return chunk_andnot(chunk_splat(0xFF), _mm_cmpeq_epi8(_mm_min_epu8(a, b), a));
+	}
+	static inline Chunk chunk_shr1(Chunk a){
+		return _mm_and_si128(_mm_srli_epi16(a, 1), chunk_splat(0x7F));
+	}
+	// a bit per lane of a chunk of 0xFF/0x00 lanes
+	static inline uint32_t chunk_bits(Chunk mask){
+		return _mm_movemask_epi8(mask);
+	}
+	// 0xFF in each lane whose bit is set, 0x00 elsewhere
+	static inline Chunk chunk_mask(uint32_t bits){
+		return byte_mask_16(bits);
+	}
+#else
+	static const int CHUNK = 8;
+	struct Chunk{
+		uint8_t lane[CHUNK];
+	};
+	template<typename F> static inline Chunk chunk_map(Chunk a, Chunk b, F f){
+		Chunk result;
+		for(int i = 0; i < CHUNK; ++i)
+			result.lane[i] = f(a.lane[i], b.lane[i]);
+		return result;
+	}
+	static inline Chunk chunk_load(const uint8_t *p){
+		Chunk result;
+		std::copy(p, p + CHUNK, result.lane);
+		return result;
+	}
+	static inline void chunk_store(uint8_t *p, Chunk c){
+		std::copy(c.lane, c.lane + CHUNK, p);
+	}
+	static inline Chunk chunk_splat(uint8_t x){
+		Chunk result;
+		std::fill(result.lane, result.lane + CHUNK, x);
+		return result;
+	}
+	static inline Chunk chunk_add(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x + y); });
+	}
+	static inline Chunk chunk_sub(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x - y); });
+	}
+	static inline Chunk chunk_and(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x & y); });
+	}
+	static inline Chunk chunk_or(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x | y); });
+	}
+	static inline Chunk chunk_andnot(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x & ~y); });
+	}
+	static inline Chunk chunk_eq(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x == y ? 0xFF : 0); });
+	}
+	static inline Chunk chunk_gt(Chunk a, Chunk b){
+		return chunk_map(a, b, [](uint8_t x, uint8_t y){ return static_cast<uint8_t>(x > y ? 0xFF : 0); });
+	}
+	static inline Chunk chunk_shr1(Chunk a){
+		return chunk_map(a, a, [](uint8_t x, uint8_t){ return static_cast<uint8_t>(x >> 1); });
+	}
+	static inline uint32_t chunk_bits(Chunk mask){
+		uint32_t bits = 0;
+		for(int i = 0; i < CHUNK; ++i)
+			bits |= (mask.lane[i] & 1) << i;
+		return bits;
+	}
+	static inline Chunk chunk_mask(uint32_t bits){
+		Chunk result;
+		for(int i = 0; i < CHUNK; ++i)
+			result.lane[i] = (bits >> i & 1) ? 0xFF : 0;
+		return result;
+	}
+#endif
+
+// result = f(values) on every lane
+template<typename F> static inline void map_lanes(const uint8_t *values, uint8_t *result, F f){
+	for(int i = 0; i < LANES; i += CHUNK)
+		chunk_store(result + i, f(chunk_load(values + i)));
+}
+// bits of the lanes where f(values) is 0xFF
+template<typename F> static inline uint64_t test_lanes(const uint8_t *values, F f){
+	uint64_t bits = 0;
+	for(int i = 0; i < LANES; i += CHUNK)
+		bits |= static_cast<uint64_t>(chunk_bits(f(chunk_load(values + i)))) << i;
+	return bits;
+}
+// dest += src on the given lanes
+static inline void add_lanes(uint8_t *dest, const uint8_t *src, uint64_t lanes){
+	for(int i = 0; i < LANES; i += CHUNK){
+		Chunk mask = chunk_mask(static_cast<uint32_t>(lanes >> i));
+		chunk_store(dest + i, chunk_add(chunk_load(dest + i), chunk_and(chunk_load(src + i), mask)));
+	}
+}
+// dest = src on the given lanes
+static inline void copy_lanes(uint8_t *dest, const uint8_t *src, uint64_t lanes){
+	for(int i = 0; i < LANES; i += CHUNK){
+		Chunk mask = chunk_mask(static_cast<uint32_t>(lanes >> i));
+		chunk_store(dest + i, chunk_or(chunk_and(chunk_load(src + i), mask), chunk_andnot(chunk_load(dest + i), mask)));
+	}
+}
+// dest = 0 on the given lanes
+static inline void clear_lanes(uint8_t *dest, uint64_t lanes){
+	for(int i = 0; i < LANES; i += CHUNK)
+		chunk_store(dest + i, chunk_andnot(chunk_load(dest + i), chunk_mask(static_cast<uint32_t>(lanes >> i))));
+}
+
+static inline void _reset(LaneCall &call){
+	std::fill(call.inputs, call.inputs + 36, 0);
+	std::fill(call.outputs, call.outputs + 36, 0);
+	call.output_left = call.output_right = 0;
+	call.reason = EXIT_RUNNING;
+	call.stdout_text.clear();
+}
+
+static void _run_calls(const BoardCall &call, LaneCall *calls[], int count, unsigned nesting);
+
+// a board running on lanes; the tick works as in BoardCall::RunState, with each step
+// done for every lane holding a marble at once
+class LaneGroup{
+	public:
+		explicit LaneGroup(const Board &board);
+
+		// runs the board on a lane per call until every lane has finished
+		void run(LaneCall *lane_calls[], int count, unsigned nesting);
+
+	private:
+		// bit l of occupied[loc] is set if cell loc holds a marble on lane l, whose value
+		// is values[LANES * loc + l]; values of lanes without a marble are 0, so marbles
+		// landing on a cell can be added to it on every lane
+		struct Grid{
+			std::vector<uint64_t> occupied;
+			std::vector<uint8_t> values;
+			std::vector<uint32_t> live; // cells that have held a marble this tick
+		};
+
+		const Board &board;
+		Grid cur, next;
+		LaneCall *calls[LANES];
+		// lanes still running, lanes where a marble moved this tick, lanes where a
+		// marble reached a terminator
+		uint64_t active = 0, moved = 0, terminated = 0;
+		uint64_t filled[LANES]; // as RunState::outputs_filled
+		// as RunState::stdout_values, for the lanes of stdout_lanes
+		std::vector<uint64_t> stdout_lanes;
+		std::vector<uint8_t> stdout_values;
+		std::vector<uint16_t> stdout_columns;
+		// arguments and results of the calls this board makes
+		std::vector<LaneCall> sub_calls;
+
+		void place(uint32_t loc, const uint8_t *values, uint64_t lanes);
+		// moves the marbles of the given lanes as RunState::set_marble
+		void move(uint32_t loc, Direction dir, const uint8_t *values, uint64_t lanes);
+		void move_lane(uint32_t loc, Direction dir, uint8_t value, uint32_t lane);
+		void tick(unsigned nesting);
+		void process_call(const BoardCall &board_call, unsigned nesting);
+		void apply_call_outputs(const BoardCall &board_call,
+		                        uint32_t lane,
+		                        const uint16_t outputs[],
+		                        uint16_t output_left,
+		                        uint16_t output_right);
+		void process_synchronisers();
+		void process_cell(uint32_t loc);
+		// finalizes the given lanes and takes their marbles off the board
+		void finish(uint64_t lanes);
+		uint16_t output(const std::forward_list<uint32_t> &output_locs, uint32_t lane) const;
+};
+
+LaneGroup::LaneGroup(const Board &board): board(board){
+	size_t cells = board.cells.size();
+	for(Grid *grid : {&cur, &next}){
+		grid->occupied.assign(cells, 0);
+		grid->values.assign(LANES * cells, 0);
+	}
+	stdout_lanes.assign(board.width, 0);
+	stdout_values.assign(LANES * board.width, 0);
+	sub_calls.resize(LANES);
+}
+
+void LaneGroup::run(LaneCall *lane_calls[], int count, unsigned nesting){
+	std::copy(lane_calls, lane_calls + count, calls);
+	active = count == LANES ? ~UINT64_C(0) : (UINT64_C(1) << count) - 1;
+	moved = active;
+	terminated = 0;
+	std::fill(filled, filled + LANES, 0);
+
+	uint8_t values[LANES] = { };
+	for(const std::pair<uint32_t, uint8_t> &marble : board.initial_marbles){
+		std::fill(values, values + count, marble.second);
+		place(marble.first, values, active);
+	}
+	for(int i = 0; i < 36; ++i){
+		if(board.inputs[i].empty())
+			continue;
+		for(int lane = 0; lane < count; ++lane)
+			values[lane] = calls[lane]->inputs[i];
+		for(uint32_t loc : board.inputs[i])
+			place(loc, values, active);
+	}
+
+	while(active){
+		// as RunState::is_finished, per lane
+		uint64_t finished = active & (terminated | ~moved);
+		if(board.required_outputs){
+			for(uint64_t lanes = active & ~finished; lanes; lanes &= lanes - 1)
+				if(filled[lowest_bit(lanes)] == board.required_outputs)
+					finished |= lanes & -lanes;
+		}
+		if(finished)
+			finish(finished);
+		if(active)
+			tick(nesting);
+	}
+	cur.live.clear();
+}
+
+void LaneGroup::place(uint32_t loc, const uint8_t *values, uint64_t lanes){
+	if(!cur.occupied[loc])
+		cur.live.push_back(loc);
+	cur.occupied[loc] |= lanes;
+	add_lanes(&cur.values[LANES * loc], values, lanes);
+}
+
+void LaneGroup::move(uint32_t loc, Direction dir, const uint8_t *values, uint64_t lanes){
+	if(!lanes)
+		return;
+	uint32_t target = board.route(loc, dir);
+	if(target >= Board::ROUTE_STDOUT){
+		if(target != Board::ROUTE_DESTROYED){
+			uint16_t x = target & ~Board::ROUTE_STDOUT;
+			if(!stdout_lanes[x])
+				stdout_columns.push_back(x);
+			stdout_lanes[x] |= lanes;
+			copy_lanes(&stdout_values[LANES * x], values, lanes);
+		}
+		return;
+	}
+
+	if(!next.occupied[target])
+		next.live.push_back(target);
+	next.occupied[target] |= lanes;
+	add_lanes(&next.values[LANES * target], values, lanes);
+
+	const Cell &cell = board.cells[target];
+	if(cell.device == DV_TERMINATOR){
+		terminated |= lanes;
+	}else if(cell.device == DV_OUTPUT){
+		uint64_t bit = Board::output_bit(cell.value);
+		for(; lanes; lanes &= lanes - 1)
+			filled[lowest_bit(lanes)] |= bit;
+	}
+}
+
+void LaneGroup::move_lane(uint32_t loc, Direction dir, uint8_t value, uint32_t lane){
+	uint8_t values[LANES] = { };
+	values[lane] = value;
+	move(loc, dir, values, UINT64_C(1) << lane);
+}
+
+void LaneGroup::tick(unsigned nesting){
+	moved = 0;
+	// board calls are listed top-bottom left-right, the order RunState runs them in
+	for(const BoardCall &board_call : board.board_calls)
+		process_call(board_call, nesting);
+	process_synchronisers();
+	std::sort(cur.live.begin(), cur.live.end());
+	for(uint32_t loc : cur.live)
+		process_cell(loc);
+
+	for(uint32_t loc : cur.live){
+		cur.occupied[loc] = 0;
+		std::fill(&cur.values[LANES * loc], &cur.values[LANES * (loc + 1)], 0);
+	}
+	cur.live.clear();
+	std::swap(cur, next);
+
+	std::sort(stdout_columns.begin(), stdout_columns.end());
+	for(uint16_t x : stdout_columns){
+		for(uint64_t lanes = stdout_lanes[x]; lanes; lanes &= lanes - 1){
+			uint32_t lane = lowest_bit(lanes);
+			calls[lane]->stdout_text.push_back(stdout_values[LANES * x + lane]);
+		}
+		stdout_lanes[x] = 0;
+	}
+	stdout_columns.clear();
+}
+
+void LaneGroup::process_call(const BoardCall &board_call, unsigned nesting){
+	const Board &callee = *board_call.board;
+	uint32_t loc = board.index(board_call.x, board_call.y);
+	uint64_t ready = active, held = 0;
+	for(int i = 0; i < callee.length; ++i){
+		held |= cur.occupied[loc + i];
+		if(!callee.inputs[i].empty())
+			ready &= cur.occupied[loc + i];
+	}
+	// marbles wait on calls that are not ready
+	if(held & ~ready){
+		for(uint32_t i = loc, end = loc + callee.length; i < end; ++i)
+			move(i, DIR_STAY, &cur.values[LANES * i], cur.occupied[i] & ~ready);
+	}
+	if(!ready)
+		return;
+
+	// the lanes whose result is not cached run the call together
+	CallCache &call_cache = board_call.interpreter->call_cache;
+	bool cacheable = callee.pure && call_cache.enabled();
+	LaneCall *pending[LANES];
+	uint32_t pending_lanes[LANES];
+	int count = 0;
+	for(uint64_t lanes = ready; lanes; lanes &= lanes - 1){
+		uint32_t lane = lowest_bit(lanes);
+		LaneCall &sub_call = sub_calls[count];
+		_reset(sub_call);
+		for(int i = 0; i < callee.length; ++i)
+			sub_call.inputs[i] = cur.values[LANES * (loc + i) + lane];
+		CallResult result;
+		if(cacheable && call_cache.find(&callee, sub_call.inputs, result)){
+			apply_call_outputs(board_call, lane, result.outputs, result.output_left, result.output_right);
+			continue;
+		}
+		pending[count] = &sub_call;
+		pending_lanes[count++] = lane;
+	}
+	if(count)
+		_run_calls(board_call, pending, count, nesting + 1);
+	for(int i = 0; i < count; ++i){
+		const LaneCall &sub_call = *pending[i];
+		if(cacheable){
+			CallResult result;
+			std::copy(sub_call.outputs, sub_call.outputs + 36, result.outputs);
+			result.output_left = sub_call.output_left;
+			result.output_right = sub_call.output_right;
+			call_cache.insert(&callee, sub_call.inputs, result);
+		}
+		apply_call_outputs(board_call, pending_lanes[i], sub_call.outputs, sub_call.output_left, sub_call.output_right);
+		std::vector<uint8_t> &text = calls[pending_lanes[i]]->stdout_text;
+		text.insert(text.end(), sub_call.stdout_text.begin(), sub_call.stdout_text.end());
+	}
+	moved |= ready;
+}
+
+void LaneGroup::apply_call_outputs(const BoardCall &board_call,
+                                   uint32_t lane,
+                                   const uint16_t outputs[],
+                                   uint16_t output_left,
+                                   uint16_t output_right){
+	uint32_t loc = board.index(board_call.x, board_call.y);
+	for(int i = 0; i < board_call.board->length; ++i)
+		if(outputs[i] >> 8)
+			move_lane(loc + i, DIR_DOWN, outputs[i], lane);
+	if(output_left >> 8)
+		move_lane(loc, DIR_LEFT, output_left, lane);
+	if(output_right >> 8)
+		move_lane(loc + (board_call.board->length - 1), DIR_RIGHT, output_right, lane);
+}
+
+void LaneGroup::process_synchronisers(){
+	for(int i = 0; i < 36; ++i){
+		const std::forward_list<uint32_t> &group = board.synchronisers[i];
+		// lanes where every synchroniser of the group holds a marble
+		uint64_t all = active, any = 0;
+		for(uint32_t loc : group){
+			all &= cur.occupied[loc];
+			any |= cur.occupied[loc];
+		}
+		if(!any)
+			continue;
+		for(uint32_t loc : group){
+			const uint8_t *values = &cur.values[LANES * loc];
+			move(loc, DIR_DOWN, values, cur.occupied[loc] & all);
+			move(loc, DIR_STAY, values, cur.occupied[loc] & ~all);
+		}
+		moved |= all;
+	}
+}
+
+void LaneGroup::process_cell(uint32_t loc){
+	uint64_t lanes = cur.occupied[loc];
+	if(!lanes)
+		return;
+	const uint8_t *values = &cur.values[LANES * loc];
+	const Cell &cell = board.cells[loc];
+	Chunk k = chunk_splat(cell.value);
+	uint8_t result[LANES];
+	switch(cell.device){
+		case DV_LEFT_DEFLECTOR:
+			move(loc, DIR_LEFT, values, lanes);
+			moved |= lanes;
+		break;
+		case DV_RIGHT_DEFLECTOR:
+			move(loc, DIR_RIGHT, values, lanes);
+			moved |= lanes;
+		break;
+		case DV_PORTAL:
+		{
+			// a marble leaves through the other portal of a pair; lanes_supported()
+			// rules out larger groups, where the exit is random
+			const std::vector<uint32_t> &portals = board.portals[cell.value];
+			uint32_t out_loc = portals.size() == 1 ? loc : portals[portals[0] == loc ? 1 : 0];
+			move(out_loc, DIR_DOWN, values, lanes);
+			moved |= lanes;
+		}
+		break;
+		case DV_EQUALS:
+		case DV_GREATER_THAN:
+		case DV_LESS_THAN:
+		{
+			uint64_t down = lanes & test_lanes(values, [k, &cell](Chunk v){
+				return cell.device == DV_EQUALS ? chunk_eq(v, k) :
+				       cell.device == DV_GREATER_THAN ? chunk_gt(v, k) : chunk_gt(k, v);
+			});
+			move(loc, DIR_DOWN, values, down);
+			move(loc, DIR_RIGHT, values, lanes & ~down);
+			moved |= lanes;
+		}
+		break;
+		case DV_ADDER:
+		case DV_INCREMENTOR:
+			map_lanes(values, result, [k](Chunk v){ return chunk_add(v, k); });
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		break;
+		case DV_SUBTRACTOR:
+		case DV_DECREMENTOR:
+			map_lanes(values, result, [k](Chunk v){ return chunk_sub(v, k); });
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		break;
+		case DV_BIT_CHECKER:
+		{
+			Chunk bit = chunk_splat(cell.value < 8 ? 1 << cell.value : 0), zero = chunk_splat(0), one = chunk_splat(1);
+			map_lanes(values, result, [bit, zero, one](Chunk v){
+				return chunk_andnot(one, chunk_eq(chunk_and(v, bit), zero));
+			});
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		}
+		break;
+		case DV_LEFT_BIT_SHIFTER:
+			map_lanes(values, result, [](Chunk v){ return chunk_add(v, v); });
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		break;
+		case DV_RIGHT_BIT_SHIFTER:
+			map_lanes(values, result, [](Chunk v){ return chunk_shr1(v); });
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		break;
+		case DV_BINARY_NOT:
+			map_lanes(values, result, [](Chunk v){ return chunk_andnot(chunk_splat(0xFF), v); });
+			move(loc, DIR_DOWN, result, lanes);
+			moved |= lanes;
+		break;
+		case DV_OUTPUT:
+			move(loc, DIR_STAY, values, lanes);
+		break;
+		case DV_TRASH_BIN:
+			moved |= lanes;
+		break;
+		case DV_CLONER:
+			move(loc, DIR_LEFT, values, lanes);
+			move(loc, DIR_RIGHT, values, lanes);
+			moved |= lanes;
+		break;
+		case DV_TERMINATOR:
+			terminated |= lanes;
+		break;
+		case DV_BLANK:
+		case DV_INPUT:
+			move(loc, DIR_DOWN, values, lanes);
+			moved |= lanes;
+		break;
+		default:
+			// board calls and synchronisers are processed before the cells; stdin and
+			// random devices are not supported
+		break;
+	}
+}
+
+void LaneGroup::finish(uint64_t lanes){
+	for(uint64_t rest = lanes; rest; rest &= rest - 1){
+		uint32_t lane = lowest_bit(rest);
+		LaneCall &call = *calls[lane];
+		for(int i = 0; i < board.length; ++i)
+			call.outputs[i] = output(board.outputs[i], lane);
+		call.output_left = output(board.output_left, lane);
+		call.output_right = output(board.output_right, lane);
+		// as RunState::exit_reason
+		if(terminated >> lane & 1)
+			call.reason = EXIT_TERMINATOR;
+		else if(!(moved >> lane & 1))
+			call.reason = EXIT_NO_ACTIVITY;
+		else
+			call.reason = EXIT_OUTPUTS_FILLED;
+	}
+	for(uint32_t loc : cur.live){
+		if(cur.occupied[loc] & lanes){
+			cur.occupied[loc] &= ~lanes;
+			clear_lanes(&cur.values[LANES * loc], lanes);
+		}
+	}
+	active &= ~lanes;
+}
+
+uint16_t LaneGroup::output(const std::forward_list<uint32_t> &output_locs, uint32_t lane) const {
+	uint16_t output = 0;
+	bool filled = false;
+	for(uint32_t loc : output_locs){
+		if(cur.occupied[loc] >> lane & 1)
+			output = (output + cur.values[LANES * loc + lane]) & 0xFF, filled = true;
+	}
+	return filled ? output | 0xFF00 : 0;
+}
+
+// idle groups of each board, reused by later calls on the same thread
+static thread_local std::unordered_map<const Board *, std::vector<std::unique_ptr<LaneGroup>>> free_groups;
+
+static void _run_calls(const BoardCall &call, LaneCall *calls[], int count, unsigned nesting){
+	if(nesting >= MAX_LANE_NESTING){
+		for(int i = 0; i < count; ++i){
+			BoardCall::RunState *rs = call.new_run_state(calls[i]->inputs);
+			rs->capture_stdout(&calls[i]->stdout_text);
+			rs->run();
+			std::copy(rs->outputs, rs->outputs + 36, calls[i]->outputs);
+			calls[i]->output_left = rs->output_left;
+			calls[i]->output_right = rs->output_right;
+			calls[i]->reason = rs->exit_reason();
+			BoardCall::recycle(rs);
+		}
+		return;
+	}
+	std::vector<std::unique_ptr<LaneGroup>> &pool = free_groups[call.board];
+	std::unique_ptr<LaneGroup> group;
+	if(pool.empty()){
+		group.reset(new LaneGroup(*call.board));
+	}else{
+		group = std::move(pool.back());
+		pool.pop_back();
+	}
+	group->run(calls, count, nesting);
+	pool.push_back(std::move(group));
+}
+
+bool lanes_supported(const Board &board){
+	std::unordered_set<const Board *> visited{&board};
+	std::vector<const Board *> stack{&board};
+	while(!stack.empty()){
+		const Board &current = *stack.back();
+		stack.pop_back();
+		for(const Cell &cell : current.cells)
+			if(cell.device == DV_STDIN || cell.device == DV_RANDOM)
+				return false;
+		for(const std::vector<uint32_t> &portals : current.portals)
+			if(portals.size() > 2)
+				return false;
+		for(const BoardCall &board_call : current.board_calls)
+			if(visited.insert(board_call.board).second)
+				stack.push_back(board_call.board);
+	}
+	return true;
+}
+
+void run_lanes(const BoardCall &call, LaneCall calls[], int count){
+	LaneCall *lane_calls[LANES];
+	for(int i = 0; i < count; ++i)
+		lane_calls[i] = &calls[i];
+	_run_calls(call, lane_calls, count, 0);
+}
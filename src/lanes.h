@@ -0,0 +1,36 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "board.h"
+
+#include <cstdint>
+#include <vector>
+
+// the lanes engine: runs up to LANES calls of the same board side by side, one per
+// lane. each cell holds a bitmask of the lanes with a marble on it and a vector of
+// their values, so every device acts on all lanes at once; lanes taking different
+// paths are masked. calls made by the board are run the same way, grouping the
+// lanes that make the same call in the same tick
+
+static const int LANES = 64;
+
+// arguments and results of a call run on a lane
+struct LaneCall{
+	uint8_t inputs[36] = { };
+
+	// as in BoardCall::RunState
+	uint16_t outputs[36] = { };
+	uint16_t output_left = 0, output_right = 0;
+	ExitReason reason = EXIT_RUNNING;
+	std::vector<uint8_t> stdout_text;
+};
+
+// true if board and the boards it calls can run on lanes: none of them reads stdin or
+// uses randomness (random devices, or groups of more than two portals)
+bool lanes_supported(const Board &board);
+
+// runs count (at most LANES) calls of call.board side by side
+// the board must be supported; max_depth and --on-cycle are not applied
+void run_lanes(const BoardCall &call, LaneCall calls[], int count);
+
+#endif // LANES_H
@@ -8,54 +8,179 @@
 #include "trim.h"
 
 #include <algorithm>
-#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <deque>
 #include <forward_list>
-#include <fstream>
-#include <list>
 #include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+// lines of one board; consecutive in SourceFile::get_lines()
+struct LineRange{
+	const SourceLine *first, *last;
+
+	inline const SourceLine *begin() const {
+		return first;
+	}
+	inline const SourceLine *end() const {
+		return last;
+	}
+	inline size_t size() const {
+		return last - first;
+	}
+};
+
+// names of boards, for finding the names equivalent to a given name (see _names_equivalent)
+// without comparing it to each one. a name is equivalent to a name at least as long if
+// it is a prefix of that name whose length is a period of that name; so names are
+// filed under all those prefixes, and their own prefixes of that kind are looked up
+class NameIndex{
+	public:
+		void insert(const std::string &name);
+		void erase(const std::string &name);
+		// the first (in std::map order) name equivalent to name, or "" if there is none
+		std::string find_equivalent(const std::string &name) const;
+	private:
+		std::unordered_map<std::string, std::set<std::string>> by_prefix;
+};
+
+// board names, for finding the longest name that a call text starts with
+class NameTrie{
+	public:
+		NameTrie();
+		void insert(const std::string &name, unsigned id);
+		// length of the longest name that text starts with, and its board id; 0 if none
+		size_t longest_match(const char *text, size_t length, unsigned &id) const;
+	private:
+		// node 0 is the root; the child of a node for a character is at node << 8 | character
+		std::unordered_map<uint64_t, uint32_t> children;
+		std::vector<unsigned> ids; // of the name ending at each node, NO_BOARD if none
+		static const unsigned NO_BOARD = UINT_MAX;
+};
+
+// files loaded so far; each file is loaded once, however often it is included
+struct IncludeRegistry{
+	struct File{
+		bool loading; // true until the file and the files it includes are loaded
+		std::map<std::string, unsigned> lookup; // as returned by load_mbl_file
+	};
+	std::map<std::string, File> files; // by canonical path
+	// canonical path of the first file with the given contents (hash, size)
+	std::map<std::pair<uint64_t, size_t>, std::string> contents;
+	std::vector<std::string> stack; // files being loaded, to report include cycles
+	std::vector<SourceInfo> sources; // every file read
+	bool cylindrical; // as passed to load_mbl_file
+};
+
 // helper functions..
-static inline bool _load_file(std::string file, std::list<SourceLine> &lines);
+static inline bool _load_mbl_file(std::string file,
+                                  std::deque<Board> &boards,
+                                  std::map<std::string, unsigned> &lookup,
+                                  IncludeRegistry &registry);
+static inline std::string _canonical_path(const std::string &file);
+static inline std::vector<size_t> _periods(const std::string &name);
 static inline bool _names_equivalent(const std::string &name1, const std::string &name2);
-static inline bool _strip_blank_lines(std::list<SourceLine> &lines);
-static inline void _process_cell(const std::string &cell, unsigned pos, Board &board);
-static inline bool _load_board(const std::list<SourceLine> &lines,
-							   Board &board);
-static inline bool _load_boards(std::list<SourceLine> &lines, 
-								std::vector<Board> &boards, // global
+static inline void _process_cell(char first, char second, unsigned pos, Board &board);
+static inline bool _load_board(const LineRange &lines,
+							   Board &board,
+							   bool cylindrical);
+static inline bool _load_boards(const std::vector<SourceLine> &lines,
+								std::deque<Board> &boards, // global
 								std::map<std::string, unsigned> &self_ids, // lookup for this file's boards
 								std::map<std::string, unsigned> &include_ids, // lookup for included file's boards
-								std::map<unsigned, std::list<SourceLine>> &sources, // sources to process
-								std::string filename
+								std::map<unsigned, LineRange> &sources, // sources to process
+								std::string filename,
+								IncludeRegistry &registry
 								);
-static inline bool _resolve_board_calls(std::vector<Board> &boards,
-										const std::map<unsigned, std::list<SourceLine>> &board_sources,
+static inline bool _resolve_board_calls(std::deque<Board> &boards,
+										const std::map<unsigned, LineRange> &board_sources,
 										const std::map<std::string, unsigned> &lookup,
 										const std::map<std::string, unsigned> &include_lookup
 										);
+static inline bool _has_side_effects(const Board &board);
+static inline void _mark_pure_boards(std::deque<Board> &boards,
+                                     const std::vector<unsigned> &ids);
 
 const std::string include_prefix = "#include";
 
-static inline bool _load_file(std::string file, std::list<SourceLine> &lines){
-	unsigned line_number = 0;
-	std::fstream fs;
+void NameIndex::insert(const std::string &name){
+	for(size_t period : _periods(name))
+		by_prefix[name.substr(0, period)].insert(name);
+}
+void NameIndex::erase(const std::string &name){
+	for(size_t period : _periods(name)){
+		auto entry = by_prefix.find(name.substr(0, period));
+		entry->second.erase(name);
+		if(entry->second.empty())
+			by_prefix.erase(entry);
+	}
+}
+std::string NameIndex::find_equivalent(const std::string &name) const {
+	std::string result = "";
+	// names at least as long
+	auto entry = by_prefix.find(name);
+	if(entry != by_prefix.end())
+		result = *entry->second.begin();
+	// shorter names
+	for(size_t period : _periods(name)){
+		std::string prefix = name.substr(0, period);
+		if(period == name.length() || (result != "" && prefix >= result))
+			continue;
+		entry = by_prefix.find(prefix);
+		if(entry != by_prefix.end() && entry->second.count(prefix))
+			result = prefix;
+	}
+	return result;
+}
+
+const unsigned NameTrie::NO_BOARD;
 
-	fs.open(file.c_str(), std::ios_base::in);
-	if(!fs.fail()){
-		for(std::string line; std::getline(fs, line);){
-			lines.push_back(SourceLine(file, ++line_number, line));
-		}
-		fs.close();
-		return true;
-	}else{
-		emit_error("Error reading from file `" + file + "`: `" + std::strerror(errno) + "`");
-		return false;
+NameTrie::NameTrie(): ids(1, NO_BOARD){}
+void NameTrie::insert(const std::string &name, unsigned id){
+	uint32_t node = 0;
+	for(char c : name){
+		auto child = children.emplace(static_cast<uint64_t>(node) << 8 | static_cast<uint8_t>(c), ids.size());
+		if(child.second)
+			ids.push_back(NO_BOARD);
+		node = child.first->second;
 	}
+	ids[node] = id;
+}
+size_t NameTrie::longest_match(const char *text, size_t length, unsigned &id) const {
+	size_t match = 0;
+	uint32_t node = 0;
+	for(size_t i = 0; i < length; ++i){
+		auto child = children.find(static_cast<uint64_t>(node) << 8 | static_cast<uint8_t>(text[i]));
+		if(child == children.end())
+			break;
+		node = child->second;
+		if(ids[node] != NO_BOARD)
+			match = i + 1, id = ids[node];
+	}
+	return match;
 }
 
+// lengths p for which name[i] == name[i + p] everywhere, from the prefix function;
+// always includes the length of the name
+static inline std::vector<size_t> _periods(const std::string &name){
+	std::vector<size_t> border(name.length() + 1, 0), periods;
+	for(size_t i = 1; i < name.length(); ++i){
+		size_t k = border[i];
+		while(k > 0 && name[i] != name[k])
+			k = border[k];
+		border[i + 1] = name[i] == name[k] ? k + 1 : 0;
+	}
+	for(size_t k = border[name.length()]; k > 0; k = border[k])
+		periods.push_back(name.length() - k);
+	if(!name.empty())
+		periods.push_back(name.length());
+	return periods;
+}
+// true if the longer name consists of repetitions of the shorter (the last one may be cut off)
 static inline bool _names_equivalent(const std::string &name1, const std::string &name2){
 	if(name1.length() == 0 || name2.length() == 0) return false;
 
@@ -73,69 +198,27 @@ static inline bool _names_equivalent(const std::string &name1, const std::string
 	}
 
 	std::string::const_iterator sitr = sbeg, litr = lbeg;
-	while(litr != lend && *litr++ == *sitr++)
-		if(sitr == send)
+	while(litr != lend && *litr == *sitr){
+		++litr;
+		if(++sitr == send)
 			sitr = sbeg;
-	return litr == lend;
-}
-static inline bool _strip_blank_lines(std::list<SourceLine> &lines){
-	auto itr = lines.begin();
-	while(itr != lines.end()){
-		std::string stripped = itr->get_stripped();
-		if(!itr->is_include() && trim_left(stripped) == "")
-			lines.erase(itr++);
-		else 
-			++itr;
 	}
-	return true;
+	return litr == lend;
 }
 static inline std::string _make_full_name(std::string file, unsigned line, std::string name){
 	return file + ":" + std::to_string(line) + "#" + name;
 }
-static inline bool _is_base36(char x){
-	return ('0' <= x && x <= '9') || ('A' <= x && x <= 'Z');
-}
-static inline void _process_cell(const std::string &cell, unsigned pos, Board &board){
-	if(cell.find_first_not_of("0123456789ABCDEF") == std::string::npos){
+static inline void _process_cell(char first, char second, unsigned pos, Board &board){
+	const CellToken &token = cell_token(first, second);
+	if(token.marble){
 		board.cells[pos] = Cell(DV_BLANK, 0);
 		board.initial_marbles.push_front(std::pair<uint32_t, uint8_t>{
 			pos,
-			std::stoi(cell, nullptr, 16)
+			token.value
 		});
-	}else if(cell == ".." || cell == "  "){
-		board.cells[pos] = Cell(DV_BLANK, 0);
 	}else{
-		// try to match device; fall back on board call if necessary
-		Device device = DV_BOARD;
-		uint8_t value = cell[1];
-		value = ('0' <= value && value <= '9') ? (value - '0') : (value - 'A' + 10);
-		switch(cell[0]){
-			case '/': if(cell[1] == '/') device = DV_LEFT_DEFLECTOR;
-					  else if(cell[1] == '\\') device = DV_CLONER; break;
-			case '\\': if(cell[1] == '\\') device = DV_RIGHT_DEFLECTOR;
-					   else if(cell[1] == '/') device = DV_TRASH_BIN; break;
-			case '@': if(_is_base36(cell[1])) device = DV_PORTAL; break;
-			case '&': if(_is_base36(cell[1])) device = DV_SYNCHRONISER; break;
-			case '=': if(_is_base36(cell[1])) device = DV_EQUALS; break;
-			case '>': if(_is_base36(cell[1])) device = DV_GREATER_THAN;
-					  else if(cell[1] == '>') device = DV_RIGHT_BIT_SHIFTER; break;
-			case '<': if(_is_base36(cell[1])) device = DV_LESS_THAN;
-					  else if(cell[1] == '<') device = DV_LEFT_BIT_SHIFTER; break;
-			case '+': if(_is_base36(cell[1])) device = DV_ADDER;
-					  else if(cell[1] == '+') device = DV_INCREMENTOR, value = 1; break;
-			case '-': if(_is_base36(cell[1])) device = DV_SUBTRACTOR;
-			          else if(cell[1] == '-') device = DV_DECREMENTOR, value = 1; break;
-			case '^': if('0' <= cell[1] && cell[1] <= '7') device = DV_BIT_CHECKER; break;
-			case '~': if(cell[1] == '~') device = DV_BINARY_NOT; break;
-			case ']': if(cell[1] == ']') device = DV_STDIN; break;
-			case '}': if(_is_base36(cell[1])) device = DV_INPUT; break;
-			case '{': if(_is_base36(cell[1])) device = DV_OUTPUT;
-					  else if(cell[1] == '<') device = DV_OUTPUT, value = 255;
-					  else if(cell[1] == '>') device = DV_OUTPUT, value = 254; break;
-			case '!': if(cell[1] == '!') device = DV_TERMINATOR; break;
-			case '?': if(_is_base36(cell[1])) device = DV_RANDOM; 
-					  else if(cell[1] == '?') device = DV_RANDOM, value = 253; break;
-		}
+		Device device = static_cast<Device>(token.device);
+		uint8_t value = token.value;
 		if(device == DV_INPUT){
 			board.inputs[value].push_front(pos);
 		}else if(device == DV_OUTPUT){
@@ -150,30 +233,31 @@ static inline void _process_cell(const std::string &cell, unsigned pos, Board &b
 		board.cells[pos] = Cell(device, value);
 	}
 }
-static inline bool _load_board(const std::list<SourceLine> &lines,
-							   Board &board){
+static inline bool _load_board(const LineRange &lines,
+							   Board &board,
+							   bool cylindrical){
 	// first get dimensions of board..
 	board.height = lines.size();
 	for(const auto &line : lines){
-		std::string sline = line.get_stripped();
+		Slice sline = line.get_stripped();
 		if(!line.is_spaced()){
 			// length must be multiple of two
-			if(sline.length() % 2){
-				line.emit_error("Unexpected character", sline.length() - 1);
+			if(sline.length % 2){
+				line.emit_error("Unexpected character", sline.length - 1);
 				return false;
 			}
-			board.width = std::max<uint16_t>(board.width, sline.length() / 2);
+			board.width = std::max<uint16_t>(board.width, sline.length / 2);
 		}else {
 			// spaced format; width is (length - 1)/3 
 			// make sure properly formatted..
-			for(unsigned i = 0; i < sline.length(); ++i)
+			for(unsigned i = 0; i < sline.length; ++i)
 				if(i % 3 == 2 && sline[i] != ' '){
 					line.emit_error("Expecting space", i);
 					return false;
 				}else if(i % 3 != 2 && sline[i] == ' '){
 					line.emit_error("Not expecting space", i);
 				}
-			board.width = std::max<uint16_t>(board.width, (sline.length() + 2) / 3);
+			board.width = std::max<uint16_t>(board.width, (sline.length + 2) / 3);
 		}
 	}
 	// resize cells
@@ -181,18 +265,14 @@ static inline bool _load_board(const std::list<SourceLine> &lines,
 	// load cells
 	int32_t y = 0;
 	for(const auto &line : lines){
-		std::string sline = line.get_stripped();
-		int32_t x, length = sline.length();
-		if(!line.is_spaced()){
-			// unspaced format
-			for(x = 0; 2 * x < length; ++x){
-				_process_cell(line.get_cell_text(x), board.index(x, y), board);
-			}
-		}else{
-			// spaced format
-			for(x = 0; 3 * x - 1 < length; ++x){
-				_process_cell(line.get_cell_text(x), board.index(x, y), board);
-			}
+		// cells are 2 characters, followed by a space in spaced format; the last
+		// cell can end past the end of the line
+		Slice source = line.get_source();
+		int32_t x, length = line.get_stripped().length, step = line.is_spaced() ? 3 : 2;
+		uint32_t loc = board.index(0, y);
+		for(x = 0; step * x < length; ++x){
+			size_t at = step * x;
+			_process_cell(source[at], at + 1 < source.length ? source[at + 1] : '\0', loc + x, board);
 		}
 		for(; x < board.width; ++x){
 			board.cells[board.index(x, y)] = Cell(DV_BLANK, 0);
@@ -209,67 +289,73 @@ static inline bool _load_board(const std::list<SourceLine> &lines,
 	board.output_left.reverse();
 	board.output_right.reverse();
 	// initialize
-	board.initialize();
+	board.initialize(cylindrical);
 	return true;
 }
-static inline bool _load_boards(std::list<SourceLine> &lines, 
-								std::vector<Board> &boards, // global
+static inline bool _load_boards(const std::vector<SourceLine> &lines,
+								std::deque<Board> &boards, // global
 								std::map<std::string, unsigned> &self_ids, // lookup for this file's boards
 								std::map<std::string, unsigned> &include_ids, // lookup for included file's boards
-								std::map<unsigned, std::list<SourceLine>> &sources, // sources to process
-								std::string filename
+								std::map<unsigned, LineRange> &sources, // sources to process
+								std::string filename,
+								IncludeRegistry &registry
 								){
 	unsigned id = boards.size();
-	std::list<SourceLine> cur_board_lines;
+	// blank lines are already left out, so a board is every line up to the next
+	// #include or board declaration
+	const SourceLine *itr = lines.data(), *end = lines.data() + lines.size();
+	LineRange cur_board_lines{itr, itr};
 	bool is_in_board = true;
+	// names in self_ids and include_ids
+	NameIndex self_index, include_index;
 	// create new board (MB)
 	boards.resize(boards.size() + 1);
 	boards[id].full_name = _make_full_name(filename, 0, "MB");
 	boards[id].short_name = "MB";
 
-	for(auto itr = lines.begin(); itr != lines.end(); ++itr){
+	for(; itr != end; ++itr){
 		if(is_in_board && (itr->is_include() || (itr->get_source()[0] == ':'))){
 			// end current board..
-			if(!_load_board(cur_board_lines, boards[id]))
+			cur_board_lines.last = itr;
+			if(!_load_board(cur_board_lines, boards[id], registry.cylindrical))
 				return false;
 			sources[id] = cur_board_lines;
 			self_ids[boards[id].actual_name] = id;
-			cur_board_lines.clear();
-			for(const auto &entry : include_ids){
-				if(_names_equivalent(boards[id].short_name, entry.first)){
-					include_ids.erase(entry.first);
-					break;
-				}
+			self_index.insert(boards[id].actual_name);
+			std::string replaced = include_index.find_equivalent(boards[id].short_name);
+			if(replaced != ""){
+				include_ids.erase(replaced);
+				include_index.erase(replaced);
 			}
 			is_in_board = false;
 		}
 		if(itr->is_include()){
 			// load included file
-			std::list<SourceLine> included_file;
-			std::string file = itr->get_source().substr(include_prefix.size());
+			std::string file = itr->get_source().str().substr(include_prefix.size());
 			trim_both(file);
 
 			std::map<std::string, unsigned> temp_lookup;
 			// load mbl file
-			if(!load_mbl_file(file, boards, temp_lookup))
+			if(!_load_mbl_file(file, boards, temp_lookup, registry))
 				return false;
 			// filter out MB; replace duplicates
-			for(const auto entry : temp_lookup){
+			for(const auto &entry : temp_lookup){
 				if(!_names_equivalent("MB", entry.first)){
-					for(const auto &entry1 : self_ids){
-						if(_names_equivalent(entry.first, entry1.first)){
-							sources.erase(self_ids[entry1.first]);
-							self_ids.erase(entry1.first);
-							break;
-						}
+					std::string replaced = self_index.find_equivalent(entry.first);
+					if(replaced != ""){
+						sources.erase(self_ids[replaced]);
+						self_ids.erase(replaced);
+						self_index.erase(replaced);
 					}
+					if(!include_ids.count(entry.first))
+						include_index.insert(entry.first);
 					include_ids[entry.first] = entry.second;
 				}
 			}
 		}else if(itr->get_source()[0] == ':'){
 			id = boards.size();
 			boards.resize(boards.size() + 1);
-			std::string short_name = itr->get_stripped().substr(1);
+			std::string short_name = itr->get_stripped().str().substr(1);
 			if(short_name == ""){
 				itr->emit_error("Unnamed board declaration forbidden", 1);
 				return false;
@@ -277,40 +363,42 @@ static inline bool _load_boards(std::list<SourceLine> &lines,
 			boards[id].short_name = short_name;
 			boards[id].full_name = _make_full_name(filename, itr->get_line_number(), short_name);
 			is_in_board = true;
-		}else if(is_in_board){
-			std::string trimmed = itr->get_stripped();
-			trim_left(trimmed);
-			if(trimmed != "")
-				cur_board_lines.push_back(*itr);
+			cur_board_lines.first = itr + 1;
 		}
 	}
 	// end last board
 	if(is_in_board){
-		if(!_load_board(cur_board_lines, boards[id]))
+		cur_board_lines.last = end;
+		if(!_load_board(cur_board_lines, boards[id], registry.cylindrical))
 			return false;
 		sources[id] = cur_board_lines;
 		self_ids[boards[id].actual_name] = id;
-		cur_board_lines.clear();
-		for(const auto &entry : include_ids){
-			if(_names_equivalent(boards[id].short_name, entry.first)){
-				include_ids.erase(entry.first);
-				break;
-			}
+		self_index.insert(boards[id].actual_name);
+		std::string replaced = include_index.find_equivalent(boards[id].short_name);
+		if(replaced != ""){
+			include_ids.erase(replaced);
+			include_index.erase(replaced);
 		}
 	}
 	
 	return true;
 }
 
-static inline bool _resolve_board_calls(std::vector<Board> &boards,
-										const std::map<unsigned, std::list<SourceLine>> &board_sources,
+static inline bool _resolve_board_calls(std::deque<Board> &boards,
+										const std::map<unsigned, LineRange> &board_sources,
 										const std::map<std::string, unsigned> &lookup,
 										const std::map<std::string, unsigned> &include_lookup
 										){
+	// this file's boards take precedence over included boards with the same name
+	NameTrie names;
+	for(const auto &entry : include_lookup)
+		names.insert(entry.first, entry.second);
+	for(const auto &entry : lookup)
+		names.insert(entry.first, entry.second);
 	for(const auto &board_info : lookup){
-		const std::list<SourceLine> &source = board_sources.at(board_info.second);
+		const LineRange &source = board_sources.at(board_info.second);
 		Board &board = boards[board_info.second];
-		std::list<SourceLine>::const_iterator src_itr = source.begin();
+		const SourceLine *src_itr = source.begin();
 		for(uint16_t y = 0; y < board.height; ++y, ++src_itr){
 			uint16_t x = 0;
 			int32_t start = -1;
@@ -321,30 +409,16 @@ static inline bool _resolve_board_calls(std::vector<Board> &boards,
 				if(x != board.width) type = board.cells[board.index(x, y)].device;
 				if((x == board.width || type != DV_BOARD) && start != -1){
 					// consecutive boards ended at last cell..
-					while(call_text != ""){
-						std::string best_match = "";
-						unsigned best_match_id;
+					for(size_t pos = 0; pos < call_text.length();){
 						// get best match
-						for(const auto &entry : lookup){
-							if(entry.first.size() > best_match.size()
-							&& !call_text.compare(0, entry.first.size(), entry.first)){
-								best_match = entry.first;
-								best_match_id = entry.second;
-							}
-						}
-						for(const auto &entry : include_lookup){
-							if(entry.first.size() > best_match.size()
-							&& !call_text.compare(0, entry.first.size(), entry.first)){
-								best_match = entry.first;
-								best_match_id = entry.second;
-							}
-						}
-						if(best_match != ""){
+						unsigned best_match_id;
+						size_t best_match = names.longest_match(call_text.data() + pos, call_text.length() - pos, best_match_id);
+						if(best_match){
 							// create boardcall
-							call_text = call_text.substr(best_match.length());
+							pos += best_match;
 							board.board_calls.push_front(BoardCall(&boards[best_match_id], start, y));
 							// assign board calls
-							uint16_t end = start + best_match.size()/2;
+							uint16_t end = start + best_match/2;
 							while(start < end){
 								board.cells[board.index(start++, y)].board_call = &board.board_calls.front();
 							}
@@ -354,11 +428,13 @@ static inline bool _resolve_board_calls(std::vector<Board> &boards,
 							return false;
 						}
 					}
+					call_text.clear();
 					start = -1;
 				}else if(type == DV_BOARD){
 					if(start == -1)
 						start = x;
-					call_text += src_itr->get_cell_text(x);
+					Slice cell = src_itr->get_cell_text(x);
+					call_text.append(cell.data, cell.length);
 				}
 				++x;
 			}
@@ -366,21 +442,198 @@ static inline bool _resolve_board_calls(std::vector<Board> &boards,
 		// reverse boardcalls list
 		// this allows for typical left-right top-bottom execution order
 		board.board_calls.reverse();
+		// boards without inputs are called whether or not marbles are present
+		board.always_ready_calls.clear();
+		for(const auto &board_call : board.board_calls){
+			bool has_inputs = false;
+			for(int i = 0; i < 36; ++i)
+				has_inputs |= !board_call.board->inputs[i].empty();
+			if(!has_inputs)
+				board.always_ready_calls.push_back(&board_call);
+		}
 	}
 	return true;
 }
-bool load_mbl_file(std::string file,
-				   std::vector<Board> &boards,
-				   std::map<std::string, unsigned> &lookup
-				  ){
-	std::list<SourceLine> source;
+// whether a board, not counting the boards it calls, reads stdin, uses
+// randomness or can let marbles fall off the bottom
+static inline bool _has_side_effects(const Board &board){
+	// find every cell a marble could reach, starting from cells that can
+	// hold marbles before any moves: inputs, initial marbles and board calls
+	std::vector<bool> reachable(board.cells.size());
+	std::vector<uint32_t> pending;
+	for(const auto &marble : board.initial_marbles)
+		pending.push_back(marble.first);
+	for(uint32_t loc = 0, end = board.cells.size(); loc < end; ++loc)
+		if(board.cells[loc].device == DV_INPUT || board.cells[loc].device == DV_BOARD)
+			pending.push_back(loc);
+	while(!pending.empty()){
+		uint32_t loc = pending.back();
+		pending.pop_back();
+		if(loc >= Board::ROUTE_STDOUT){
+			if(loc != Board::ROUTE_DESTROYED)
+				return true; // falls off the bottom
+			continue;
+		}
+		if(reachable[loc])
+			continue;
+		reachable[loc] = true;
+		const Cell &cell = board.cells[loc];
+		switch(cell.device){
+			case DV_STDIN:
+			case DV_RANDOM:
+				return true;
+			case DV_PORTAL:
+				if(board.portals[cell.value].size() > 2)
+					return true; // exit is chosen at random
+				for(uint32_t exit : board.portals[cell.value])
+					if(exit != loc || board.portals[cell.value].size() == 1)
+						pending.push_back(board.route(exit, DIR_DOWN));
+			break;
+			case DV_LEFT_DEFLECTOR:
+				pending.push_back(board.route(loc, DIR_LEFT));
+			break;
+			case DV_RIGHT_DEFLECTOR:
+				pending.push_back(board.route(loc, DIR_RIGHT));
+			break;
+			case DV_EQUALS:
+			case DV_GREATER_THAN:
+			case DV_LESS_THAN:
+				pending.push_back(board.route(loc, DIR_DOWN));
+				pending.push_back(board.route(loc, DIR_RIGHT));
+			break;
+			case DV_CLONER:
+				pending.push_back(board.route(loc, DIR_LEFT));
+				pending.push_back(board.route(loc, DIR_RIGHT));
+			break;
+			case DV_BOARD:
+			{
+				// outputs of the call leaving from this cell
+				const BoardCall &board_call = *cell.board_call;
+				int offset = loc % board.width - board_call.x;
+				if(!board_call.board->outputs[offset].empty())
+					pending.push_back(board.route(loc, DIR_DOWN));
+				if(offset == 0 && !board_call.board->output_left.empty())
+					pending.push_back(board.route(loc, DIR_LEFT));
+				if(offset == board_call.board->length - 1 && !board_call.board->output_right.empty())
+					pending.push_back(board.route(loc, DIR_RIGHT));
+			}
+			break;
+			case DV_OUTPUT:
+			case DV_TRASH_BIN:
+			case DV_TERMINATOR:
+			break;
+			default:
+				pending.push_back(board.route(loc, DIR_DOWN));
+			break;
+		}
+	}
+	return false;
+}
+static inline void _mark_pure_boards(std::deque<Board> &boards,
+                                     const std::vector<unsigned> &ids){
+	// only the boards given; the boards they call are already marked
+	for(unsigned id : ids){
+		Board &board = boards[id];
+		board.pure = !_has_side_effects(board);
+		board.reads_stdin = std::any_of(board.cells.begin(), board.cells.end(),
+		                                [](const Cell &cell){ return cell.device == DV_STDIN; });
+	}
+	// calling an impure board is impure, and calling a board reading stdin reads
+	// stdin; propagate until nothing changes
+	bool changed = true;
+	while(changed){
+		changed = false;
+		for(unsigned id : ids){
+			Board &board = boards[id];
+			for(const auto &board_call : board.board_calls){
+				if(board.pure && !board_call.board->pure){
+					board.pure = false;
+					changed = true;
+				}
+				if(!board.reads_stdin && board_call.board->reads_stdin){
+					board.reads_stdin = true;
+					changed = true;
+				}
+			}
+		}
+	}
+}
+static inline std::string _canonical_path(const std::string &file){
+	#if defined(_WIN32)
+		char *path = _fullpath(nullptr, file.c_str(), 0);
+	#else
+		char *path = realpath(file.c_str(), nullptr);
+	#endif
+	if(!path)
+		return file; // reported when the file is opened
+	std::string result = path;
+	std::free(path);
+	return result;
+}
+static inline bool _load_mbl_file(std::string file,
+                                  std::deque<Board> &boards,
+                                  std::map<std::string, unsigned> &lookup,
+                                  IncludeRegistry &registry){
+	std::string path = _canonical_path(file);
+	auto known = registry.files.find(path);
+	SourceFile source;
+	if(known == registry.files.end()){
+		if(!source.open(file)) return false;
+		// the same file under another name
+		registry.sources.push_back(SourceInfo{path, source.get_size(), source.get_hash()});
+		auto same = registry.contents.emplace(std::make_pair(registry.sources.back().hash, source.get_size()), path);
+		if(!same.second)
+			known = registry.files.insert(std::make_pair(path, registry.files.at(same.first->second))).first;
+	}
+	if(known != registry.files.end()){
+		if(known->second.loading){
+			std::string cycle;
+			for(const std::string &name : registry.stack)
+				cycle += name + " -> ";
+			emit_error("Include cycle: " + cycle + file);
+			return false;
+		}
+		lookup = known->second.lookup;
+		return true;
+	}
+	registry.files[path].loading = true;
+	registry.stack.push_back(file);
+
 	std::map<std::string, unsigned> include_lookup;
-	std::map<unsigned, std::list<SourceLine>> board_sources;
+	std::map<unsigned, LineRange> board_sources;
 
-	if(!_load_file(file, source)) return false;
-	if(!_strip_blank_lines(source)) return false;
-	if(!_load_boards(source, boards, lookup, include_lookup, board_sources, file)) return false;
+	if(!_load_boards(source.get_lines(), boards, lookup, include_lookup, board_sources, file, registry)) return false;
 	if(!_resolve_board_calls(boards, board_sources, lookup, include_lookup)) return false;
+	for(const auto &board_info : lookup)
+		boards[board_info.second].compile();
+	// only the boards of this file; included boards are marked when they are loaded,
+	// and boards of including files are not resolved yet
+	std::vector<unsigned> ids;
+	for(const auto &board_info : lookup)
+		ids.push_back(board_info.second);
+	_mark_pure_boards(boards, ids);
 
+	registry.stack.pop_back();
+	registry.files[path] = IncludeRegistry::File{false, lookup};
+	return true;
+}
+void mark_pure_boards(std::deque<Board> &boards){
+	std::vector<unsigned> ids(boards.size());
+	for(unsigned id = 0; id < ids.size(); ++id)
+		ids[id] = id;
+	_mark_pure_boards(boards, ids);
+}
+bool load_mbl_file(std::string file,
+				   std::deque<Board> &boards,
+				   std::map<std::string, unsigned> &lookup,
+				   bool cylindrical,
+				   std::vector<SourceInfo> *sources
+				  ){
+	IncludeRegistry registry;
+	registry.cylindrical = cylindrical;
+	if(!_load_mbl_file(file, boards, lookup, registry))
+		return false;
+	if(sources)
+		*sources = registry.sources;
 	return true;
 }
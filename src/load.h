@@ -3,13 +3,34 @@
 
 #include "board.h"
 
+#include <cstdint>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
+// a file read by load_mbl_file
+struct SourceInfo{
+	std::string path; // canonical
+	size_t size;
+	uint64_t hash; // SourceFile::get_hash()
+};
+
+// loads a file and the files it includes, each once; boards are appended to boards
+// (a deque, as board calls point to the boards they call)
+// lookup: actual_name -> index in boards for the boards of the file
+// cylindrical: routes off the sides of the boards wrap around
+// sources: if given, set to the files read
+// returns false (after emitting an error) if a file cannot be loaded or includes itself
 bool load_mbl_file(std::string file,
-				   std::vector<Board> &boards,
-				   std::map<std::string, unsigned> &lookup
+				   std::deque<Board> &boards,
+				   std::map<std::string, unsigned> &lookup,
+				   bool cylindrical,
+				   std::vector<SourceInfo> *sources = nullptr
 				  );
 
+// sets Board::pure and Board::reads_stdin of every board; call once the boards are
+// initialized and their board calls resolved, as purity depends on their routes
+void mark_pure_boards(std::deque<Board> &boards);
+
 #endif
@@ -1,21 +1,31 @@
 #include <ctime>
 #include <cstdio>
+#include <climits>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
-#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
 
+#include "batch.h"
 #include "board.h"
 #include "emit.h"
+#include "image.h"
+#include "interpreter.h"
 #include "io_functions.h"
-#include "load.h"
+#include "lanes.h"
 #include "options.h"
+#include "workers.h"
 
 option::Option *options;
 int verbosity;
 bool cylindrical;
+Engine engine;
+unsigned long max_depth;
+uint64_t random_seed;
+CyclePolicy on_cycle;
+bool parallel_calls;
 
 int main(int argc, char *argv[]){
 	// process arguments
@@ -42,15 +52,38 @@ int main(int argc, char *argv[]){
 	}
 
 	std::string filename = parse.nonOption(0);
+	// board routes depend on cylindrical
+	cylindrical = (options[OPT_CYLINDRICAL].last()->type() == OPT_TYPE_ENABLE);
+	// boards keep a pool of runstates for each thread
+	uint64_t threads = 1;
+	if(options[OPT_THREADS] && !option_value(*options[OPT_THREADS].last(), WorkerPool::max_threads(), threads))
+		return -5;
+	if(!workers.start(threads)){
+		emit_error("Could not start " + std::to_string(threads) + " threads");
+		return -10;
+	}
+	// batch runs are spread over the threads instead
+	parallel_calls = workers.enabled() && !options[OPT_BATCH];
 	// load
-	std::srand(std::time(nullptr));
 	prepare_io(true);
-	std::vector<Board> boards;
-	std::map<std::string, unsigned> lookup;
-	if(!load_mbl_file(filename, boards, lookup)){
+	Interpreter interpreter;
+	interpreter.settings.cylindrical = cylindrical;
+	std::vector<SourceInfo> sources;
+	if(!interpreter.load(filename, &sources)){
 		emit_error("Could not load file " + filename);
 		return -3;
 	}
+	std::deque<Board> &boards = interpreter.boards;
+	if(options[OPT_COMPILE_TO]){
+		if(sources.empty()){
+			emit_error(filename + " is already an image");
+			prepare_io(false);
+			return -8;
+		}
+		bool written = write_image(options[OPT_COMPILE_TO].last()->arg, boards, sources);
+		prepare_io(false);
+		return written ? 0 : -8;
+	}
 
 	// get highest input
 	int highest_input = -1;
@@ -61,17 +94,100 @@ int main(int argc, char *argv[]){
 		}
 	}
 
-	// check arguments
-	if(parse.nonOptionsCount() != 2 + highest_input){ // filename + (highest_input + 1)
+	// check arguments; with --batch, they are read from the batch file
+	if(options[OPT_BATCH] && parse.nonOptionsCount() != 1){
+		emit_error("Expected no inputs with --batch, got " + std::to_string(parse.nonOptionsCount() - 1));
+		return -4;
+	}
+	if(!options[OPT_BATCH] && parse.nonOptionsCount() != 2 + highest_input){ // filename + (highest_input + 1)
 		emit_error("Expected " + std::to_string(highest_input + 1) + " inputs, got " + std::to_string(parse.nonOptionsCount() - 1));
 		return -4;	
 	}
 
 	// misc options
 	verbosity = options[OPT_VERBOSE].count();
-	cylindrical = (options[OPT_CYLINDRICAL].last()->type() == OPT_TYPE_ENABLE);
+	engine = ENGINE_SCAN;
+	if(options[OPT_ENGINE] && !parse_engine(options[OPT_ENGINE].last()->arg, engine)){
+		emit_error(std::string("Unknown engine: ") + options[OPT_ENGINE].last()->arg);
+		prepare_io(false);
+		return -5;
+	}
+	// lanes only run --batch records; runstates use bytecode
+	bool lanes = engine == ENGINE_LANES;
+	if(lanes)
+		engine = ENGINE_BYTECODE;
+	on_cycle = CYCLE_IGNORE;
+	if(options[OPT_ON_CYCLE] && !parse_cycle_policy(options[OPT_ON_CYCLE].last()->arg, on_cycle)){
+		emit_error(std::string("Unknown cycle policy: ") + options[OPT_ON_CYCLE].last()->arg);
+		prepare_io(false);
+		return -5;
+	}
+	random_seed = std::time(nullptr);
+	if(options[OPT_SEED] && !option_value(*options[OPT_SEED].last(), UINT64_MAX, random_seed)){
+		prepare_io(false);
+		return -5;
+	}
+	// in MiB; the limit is kept in bytes
+	uint64_t memo_limit = 64;
+	if(options[OPT_MEMO_LIMIT] && !option_value(*options[OPT_MEMO_LIMIT].last(), SIZE_MAX >> 20, memo_limit)){
+		prepare_io(false);
+		return -5;
+	}
+	interpreter.call_cache.set_limit(memo_limit << 20);
+	uint64_t depth = 0;
+	if(options[OPT_MAX_DEPTH] && !option_value(*options[OPT_MAX_DEPTH].last(), ULONG_MAX, depth)){
+		prepare_io(false);
+		return -5;
+	}
+	max_depth = depth;
+	uint64_t output_buffer = 64;
+	if(options[OPT_OUTPUT_BUFFER] && !option_value(*options[OPT_OUTPUT_BUFFER].last(), MAX_OUTPUT_BUFFER, output_buffer)){
+		prepare_io(false);
+		return -5;
+	}
+	uint64_t flush_interval = 0;
+	if(options[OPT_FLUSH_INTERVAL] && !option_value(*options[OPT_FLUSH_INTERVAL].last(), UINT_MAX, flush_interval)){
+		prepare_io(false);
+		return -5;
+	}
+	const char *output = options[OPT_OUTPUT] ? options[OPT_OUTPUT].last()->arg : nullptr;
+	if(!stdout_configure(output, output_buffer << 10, flush_interval)){
+		emit_error(std::string("Could not open output file ") + output);
+		prepare_io(false);
+		return -7;
+	}
+
+	if(options[OPT_BATCH]){
+		BatchFormat format = BATCH_TEXT;
+		if(options[OPT_BATCH_FORMAT] && !parse_batch_format(options[OPT_BATCH_FORMAT].last()->arg, format)){
+			emit_error(std::string("Unknown batch format: ") + options[OPT_BATCH_FORMAT].last()->arg);
+			prepare_io(false);
+			return -5;
+		}
+		// runs share stdin, and their traces would be interleaved
+		if(boards[0].reads_stdin){
+			emit_error("Boards reading STDIN cannot be run with --batch");
+			prepare_io(false);
+			return -4;
+		}
+		if(verbosity > 0){
+			emit_warning("-v is ignored with --batch");
+			verbosity = 0;
+		}
+		if(lanes && !lanes_supported(boards[0])){
+			emit_warning("The program uses randomness, which lanes cannot run; using the bytecode engine");
+			lanes = false;
+		}else if(lanes && (max_depth || on_cycle != CYCLE_IGNORE)){
+			emit_warning("Lanes apply neither --max-depth nor --on-cycle; using the bytecode engine");
+			lanes = false;
+		}
+		interpreter.settings = option_settings();
+		int res = run_batch(interpreter, options[OPT_BATCH].last()->arg, highest_input + 1, format, lanes);
+		prepare_io(false);
+		return res;
+	}
 
-	BoardCall bc{&boards[0], 0, 0};
+	interpreter.settings = option_settings();
 	uint8_t inputs[36] = { 0 };
 
 	for(int i = 0; i <= highest_input; ++i){
@@ -96,18 +212,32 @@ int main(int argc, char *argv[]){
 	}
 
 	// if verbose, stall printing to end..
-	if(options[OPT_VERBOSE].count() > 0){
-		stdout_write = _stdout_save;
+	MemoryOutput *saved_stdout = nullptr;
+	if(verbosity > 0){
+		saved_stdout = new MemoryOutput;
+		interpreter.output.reset(saved_stdout);
 	}
 
+	BoardCall bc = interpreter.main_call();
 	BoardCall::RunState *rs = bc.call(inputs);
+	if(!rs){
+		prepare_io(false);
+		return -6;
+	}
 
-	if(options[OPT_VERBOSE].count() > 0){
+	if(saved_stdout){
+		const CallCache &call_cache = interpreter.call_cache;
 		std::fputs("Combined STDOUT: ", stdout);
-		for(uint8_t c : stdout_get_saved()){
+		for(uint8_t c : saved_stdout->text){
 			_stdout_writehex(c);
 		}
 		std::fputc('\n', stdout);
+		if(call_cache.enabled())
+			std::printf("Call cache: %llu hits, %llu misses, %llu flushes, %zu entries (%zu bytes)\n",
+			            static_cast<unsigned long long>(call_cache.hits),
+			            static_cast<unsigned long long>(call_cache.misses),
+			            static_cast<unsigned long long>(call_cache.flushes),
+			            call_cache.size(), call_cache.memory_used());
 	}
 
 	prepare_io(false);
@@ -0,0 +1,71 @@
+#include "board.h"
+#include "memo.h"
+
+#include <cstring>
+
+// rough per-entry cost: key, value, node pointers, cached hash and bucket
+static const size_t entry_overhead = 4 * sizeof(void *);
+
+void CallCache::set_limit(size_t limit){
+	this->limit = limit;
+	entries.clear();
+}
+
+bool CallCache::enabled() const {
+	return limit != 0;
+}
+
+bool CallCache::find(const Board *board, const uint8_t inputs[], CallResult &result){
+	Key key = make_key(board, inputs);
+	std::lock_guard<std::mutex> guard(lock);
+	auto itr = entries.find(key);
+	if(itr == entries.end()){
+		++misses;
+		return false;
+	}
+	++hits;
+	result = itr->second;
+	return true;
+}
+
+void CallCache::insert(const Board *board, const uint8_t inputs[], const CallResult &result){
+	Key key = make_key(board, inputs);
+	std::lock_guard<std::mutex> guard(lock);
+	if(memory_used() + sizeof(Key) + sizeof(CallResult) + entry_overhead > limit){
+		entries.clear();
+		++flushes;
+	}
+	entries[key] = result;
+}
+
+size_t CallCache::size() const {
+	return entries.size();
+}
+
+size_t CallCache::memory_used() const {
+	return entries.size() * (sizeof(Key) + sizeof(CallResult) + entry_overhead)
+	     + entries.bucket_count() * sizeof(void *);
+}
+
+CallCache::Key CallCache::make_key(const Board *board, const uint8_t inputs[]){
+	Key key;
+	key.board = board;
+	// unused inputs may hold anything; leave them out of the key
+	for(int i = 0; i < 36; ++i)
+		key.inputs[i] = (i < board->length && !board->inputs[i].empty()) ? inputs[i] : 0;
+	return key;
+}
+
+bool CallCache::Key::operator==(const Key &other) const {
+	return board == other.board && !std::memcmp(inputs, other.inputs, sizeof(inputs));
+}
+
+size_t CallCache::KeyHash::operator()(const Key &key) const {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL ^ reinterpret_cast<uintptr_t>(key.board);
+	for(int i = 0; i < 36; ++i){
+		hash ^= key.inputs[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
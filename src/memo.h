@@ -0,0 +1,53 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+struct Board;
+
+// outputs of a finished board call
+struct CallResult{
+	uint16_t outputs[36];
+	uint16_t output_left, output_right;
+};
+
+// bounded cache of results of calls to pure boards (see Board::pure)
+// when the cache would grow past its limit, it is emptied and refilled
+// calls running on the worker pool share it, so it is locked while used
+class CallCache{
+	public:
+		// limit: approximate memory cap in bytes; 0 disables the cache
+		void set_limit(size_t limit);
+		bool enabled() const;
+
+		// copies the cached result to result; false if there is none
+		// inputs are as passed to BoardCall::call
+		bool find(const Board *board, const uint8_t inputs[], CallResult &result);
+		void insert(const Board *board, const uint8_t inputs[], const CallResult &result);
+
+		uint64_t hits = 0, misses = 0, flushes = 0;
+		size_t size() const;
+		size_t memory_used() const;
+
+	private:
+		struct Key{
+			const Board *board;
+			uint8_t inputs[36];
+
+			bool operator==(const Key &other) const;
+		};
+		struct KeyHash{
+			size_t operator()(const Key &key) const;
+		};
+
+		static Key make_key(const Board *board, const uint8_t inputs[]);
+
+		std::unordered_map<Key, CallResult, KeyHash> entries;
+		size_t limit = 0;
+		std::mutex lock;
+};
+
+#endif // MEMO_H
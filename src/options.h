@@ -1,19 +1,57 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include "emit.h"
+#include "interpreter.h"
 #include "optionparser.h"
 
+#include <cstdint>
+#include <string>
+
 enum Options{
 	OPT_UNKNOWN,
 	OPT_HELP,
 	OPT_VERBOSE,
 	OPT_CYLINDRICAL,
+	OPT_ENGINE,
+	OPT_MEMO_LIMIT,
+	OPT_MAX_DEPTH,
+	OPT_SEED,
+	OPT_OUTPUT,
+	OPT_OUTPUT_BUFFER,
+	OPT_FLUSH_INTERVAL,
+	OPT_ON_CYCLE,
+	OPT_COMPILE_TO,
+	OPT_THREADS,
+	OPT_BATCH,
+	OPT_BATCH_FORMAT,
 };
 
 enum OptionsType{
 	OPT_TYPE_DISABLE,
 	OPT_TYPE_ENABLE,
 };
+
+// argument checks for options that take a value
+struct Arg: public option::Arg{
+	static option::ArgStatus Required(const option::Option &option, bool msg){
+		if(option.arg != 0 && option.arg[0] != 0)
+			return option::ARG_OK;
+		if(msg)
+			emit_error("Option " + std::string(option.name, option.namelen) + " requires an argument");
+		return option::ARG_ILLEGAL;
+	}
+	static option::ArgStatus Numeric(const option::Option &option, bool msg){
+		if(Required(option, msg) != option::ARG_OK)
+			return option::ARG_ILLEGAL;
+		if(std::string(option.arg).find_first_not_of("0123456789") == std::string::npos)
+			return option::ARG_OK;
+		if(msg)
+			emit_error("Option " + std::string(option.name, option.namelen) + " requires a nonnegative integer");
+		return option::ARG_ILLEGAL;
+	}
+};
+
 const option::Descriptor usage[] = {
 #if VMARBELOUS == 1
 	{OPT_UNKNOWN, 0, "", "" , option::Arg::None, "Usage: vmarbelous [options] file.mbl [arguments]\n"
@@ -29,13 +67,109 @@ const option::Descriptor usage[] = {
 	{OPT_CYLINDRICAL, OPT_TYPE_ENABLE, "", "enable-cylindrical", option::Arg::None, 
 	    "  --enable-cylindrical  \tEnable or disable cylindrical boards (default disabled)"},
 	{OPT_CYLINDRICAL, OPT_TYPE_DISABLE, "", "disable-cylindrical", option::Arg::None, "  --disable-cylindrical"},
+	{OPT_ENGINE, 0, "", "engine", Arg::Required,
+	    "  --engine=NAME  \tSelect tick engine: scan (default) visits every cell, sparse visits only cells holding marbles, "
+	    "bytecode is sparse running compiled boards, lanes runs --batch records 64 at a time in lockstep, "
+	    "tiles is bytecode processing the cells of large boards in bands on --threads"},
+#if VMARBELOUS == 0
+	{OPT_MEMO_LIMIT, 0, "", "memo-limit", Arg::Numeric,
+	    "  --memo-limit=MB  \tMemory for caching results of calls to side-effect-free boards, default 64; 0 disables"},
+	{OPT_MAX_DEPTH, 0, "", "max-depth", Arg::Numeric,
+	    "  --max-depth=N  \tExit with an error if board calls nest more than N deep, default 0 (no limit)"},
+	{OPT_OUTPUT, 0, "", "output", Arg::Required, "  --output=FILE  \tWrite STDOUT of the program to FILE"},
+	{OPT_OUTPUT_BUFFER, 0, "", "output-buffer", Arg::Numeric,
+	    "  --output-buffer=KB  \tSize of the STDOUT buffer, default 64, at most 1048576; 0 writes every byte immediately"},
+	{OPT_FLUSH_INTERVAL, 0, "", "flush-interval", Arg::Numeric,
+	    "  --flush-interval=MS  \tAlso write out buffered STDOUT after MS milliseconds, default 0 (only when full)"},
+	{OPT_ON_CYCLE, 0, "", "on-cycle", Arg::Required,
+	    "  --on-cycle=POLICY  \tWhen a board repeats the same ticks forever without output: ignore (default), warn or abort"},
+	{OPT_THREADS, 0, "", "threads", Arg::Numeric,
+	    "  --threads=N  \tRun board calls made in the same tick on N threads, default 1, at most 16 per core; 0 uses one per core"},
+	{OPT_BATCH, 0, "", "batch", Arg::Required,
+	    "  --batch=FILE  \tRun the program once for each line of FILE (- for STDIN), taking the line as its arguments, "
+	    "and write one result line per run"},
+	{OPT_BATCH_FORMAT, 0, "", "batch-format", Arg::Required,
+	    "  --batch-format=FORMAT  \tFormat of --batch input and results: text (default) or binary"},
+	{OPT_COMPILE_TO, 0, "", "compile-to", Arg::Required,
+	    "  --compile-to=FILE  \tWrite the loaded program to the image FILE and exit; run FILE in place of file.mbl to skip parsing"},
+#endif // VMARBELOUS == 0
+	{OPT_SEED, 0, "", "seed", Arg::Numeric,
+	    "  --seed=N  \tSeed for portals and random devices, default based on the current time"},
 	{0, 0, 0, 0, 0, 0}
 };
 
 // defined in main.cpp
 extern option::Option *options;
 
+// settings parsed from the command line; only main reads them, handing them to
+// its Interpreter with option_settings()
 extern int verbosity;
 extern bool cylindrical;
+extern Engine engine;
+extern unsigned long max_depth; // 0: unlimited
+extern uint64_t random_seed;
+extern CyclePolicy on_cycle;
+extern bool parallel_calls; // run the board calls of a tick on the worker pool
+
+inline Settings option_settings(){
+	Settings settings;
+	settings.verbosity = verbosity;
+	settings.cylindrical = cylindrical;
+	settings.engine = engine;
+	settings.max_depth = max_depth;
+	settings.random_seed = random_seed;
+	settings.on_cycle = on_cycle;
+	settings.parallel_calls = parallel_calls;
+	return settings;
+}
+
+// largest --output-buffer, in KiB (1 GiB)
+static const uint64_t MAX_OUTPUT_BUFFER = UINT64_C(1) << 20;
+
+// reads the value of an Arg::Numeric option; returns false (after emitting an
+// error) if it is larger than max
+inline bool option_value(const option::Option &option, uint64_t max, uint64_t &result){
+	result = 0;
+	for(const char *c = option.arg; *c; ++c){
+		unsigned digit = *c - '0';
+		if(digit > max || result > (max - digit) / 10){
+			emit_error("Option " + std::string(option.name, option.namelen) + " must be at most "
+			           + std::to_string(max));
+			return false;
+		}
+		result = 10 * result + digit;
+	}
+	return true;
+}
+
+// parses the argument of --engine; returns false if not an engine name
+inline bool parse_engine(const std::string &name, Engine &result){
+	if(name == "scan")
+		result = ENGINE_SCAN;
+	else if(name == "sparse")
+		result = ENGINE_SPARSE;
+	else if(name == "bytecode")
+		result = ENGINE_BYTECODE;
+	else if(name == "lanes")
+		result = ENGINE_LANES;
+	else if(name == "tiles")
+		result = ENGINE_TILES;
+	else
+		return false;
+	return true;
+}
+
+// parses the argument of --on-cycle; returns false if not a policy name
+inline bool parse_cycle_policy(const std::string &name, CyclePolicy &result){
+	if(name == "ignore")
+		result = CYCLE_IGNORE;
+	else if(name == "warn")
+		result = CYCLE_WARN;
+	else if(name == "abort")
+		result = CYCLE_ABORT;
+	else
+		return false;
+	return true;
+}
 
 #endif // OPTIONS_H
@@ -0,0 +1,20 @@
+#include "random.h"
+
+// splitmix64, to expand a seed into a full state
+static inline uint64_t _splitmix64(uint64_t &x){
+	uint64_t z = (x += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+void Random::seed(uint64_t seed){
+	for(uint64_t &word : state)
+		word = _splitmix64(seed);
+}
+
+Random Random::split(){
+	Random child;
+	child.seed(next());
+	return child;
+}
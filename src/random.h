@@ -0,0 +1,52 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// xoshiro256** generator used by portals and random devices
+// each RunState owns one, so results only depend on the seed and not on the
+// order in which boards are run
+class Random{
+	public:
+		void seed(uint64_t seed);
+		// new generator seeded from this one, for a board call
+		Random split();
+
+		inline uint64_t next(){
+			uint64_t result = rotl(state[1] * 5, 7) * 9;
+			uint64_t t = state[1] << 17;
+			state[2] ^= state[0];
+			state[3] ^= state[1];
+			state[1] ^= state[2];
+			state[0] ^= state[3];
+			state[2] ^= t;
+			state[3] = rotl(state[3], 45);
+			return result;
+		}
+		// uniform value in [0, bound) without modulo bias; bound <= 1 draws nothing
+		inline uint32_t below(uint32_t bound){
+			if(bound <= 1)
+				return 0;
+			uint64_t m = (next() >> 32) * bound;
+			if(static_cast<uint32_t>(m) < bound){
+				uint32_t threshold = -bound % bound;
+				while(static_cast<uint32_t>(m) < threshold)
+					m = (next() >> 32) * bound;
+			}
+			return m >> 32;
+		}
+
+		static const int STATE_WORDS = 4;
+		inline const uint64_t *get_state() const {
+			return state;
+		}
+
+	private:
+		static inline uint64_t rotl(uint64_t x, int k){
+			return (x << k) | (x >> (64 - k));
+		}
+
+		uint64_t state[STATE_WORDS];
+};
+
+#endif // RANDOM_H
@@ -1,52 +1,78 @@
 #include "emit.h"
 #include "source_line.h"
-#include "trim.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <utility>
 
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+	// unix-based systems: map files with mmap
+	#define UNIX 1
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
 const std::string include_prefix = "#include";
 
-SourceLine::SourceLine(std::string file_name, unsigned line_number, std::string source):
-	file_name(file_name),
-	line_number(line_number),
-	source(source){
+SourceLine::SourceLine(const SourceFile *file, unsigned line_number, size_t offset, size_t length):
+	file(file),
+	offset(offset),
+	length(length),
+	line_number(line_number){
+	const char *source = file->get_text() + offset;
+	// strip comment, then trailing whitespace
+	const char *comment = static_cast<const char *>(std::memchr(source, '#', length));
+	stripped_length = comment ? comment - source : length;
+	while(stripped_length > 0 && std::isspace(static_cast<unsigned char>(source[stripped_length - 1])))
+		--stripped_length;
 	// spaced format must have at least 1 isolated single space
-	spaced = source.find("  ") == std::string::npos && source.find(" ") != std::string::npos;
+	bool has_space = false, has_double_space = false;
+	for(size_t i = 0; i < length; ++i){
+		if(source[i] == ' '){
+			has_double_space |= has_space && source[i - 1] == ' ';
+			has_space = true;
+		}
+	}
+	spaced = has_space && !has_double_space;
 }
 
-std::string SourceLine::get_source() const {
-	return source;
+Slice SourceLine::get_source() const {
+	return Slice{file->get_text() + offset, length};
 }
 
-std::string SourceLine::get_stripped() const {
-	std::string sourceCopy = source;
-	sourceCopy = sourceCopy.substr(0, sourceCopy.find('#'));
-	return trim_right(sourceCopy);
+Slice SourceLine::get_stripped() const {
+	return Slice{file->get_text() + offset, stripped_length};
 }
 
 bool SourceLine::is_include() const {
-	return !source.compare(0, include_prefix.length(), include_prefix);
+	return length >= include_prefix.length()
+	       && !include_prefix.compare(0, std::string::npos, file->get_text() + offset, include_prefix.length());
 }
 
 void SourceLine::emit_warning(std::string text, unsigned charPos) const {
 	unsigned displacement = charPos > 30 ? charPos - 30 : 0;
-	::emit_warning(file_name + ":" + std::to_string(line_number) + ":" + 
+	::emit_warning(get_file_name() + ":" + std::to_string(line_number) + ":" +
 		std::to_string(charPos) + ": " + text);
-	::emit_warning(source.substr(displacement, 60));
-	::emit_warning(std::string(' ', charPos - displacement) + "^");
+	::emit_warning(get_source().str().substr(displacement, 60));
+	::emit_warning(std::string(charPos - displacement, ' ') + "^");
 }
 
 void SourceLine::emit_error(std::string text, unsigned charPos) const {
 	unsigned displacement = charPos > 30 ? charPos - 30 : 0;
-	::emit_error(file_name + ":" + std::to_string(line_number) + ":" + 
+	::emit_error(get_file_name() + ":" + std::to_string(line_number) + ":" +
 		std::to_string(charPos) + ": " + text);
-	::emit_error(source.substr(displacement, 60));
+	::emit_error(get_source().str().substr(displacement, 60));
 	::emit_error(std::string(charPos - displacement, ' ') + "^");
 }
 
-std::string SourceLine::get_file_name() const {
-	return file_name;
+const std::string &SourceLine::get_file_name() const {
+	return file->get_name();
 }
 unsigned SourceLine::get_line_number() const {
 	return line_number;
@@ -56,7 +82,95 @@ bool SourceLine::is_spaced() const {
 	return spaced;
 }
 
-std::string SourceLine::get_cell_text(uint16_t cell) const {
-	if(spaced) return source.substr(3 * cell, 2);
-	else return source.substr(2 * cell, 2);
+Slice SourceLine::get_cell_text(uint16_t cell) const {
+	size_t pos = std::min<size_t>(spaced ? 3 * cell : 2 * cell, length);
+	return Slice{file->get_text() + offset + pos, std::min<size_t>(2, length - pos)};
+}
+
+SourceFile::~SourceFile(){
+	#if defined(UNIX)
+		if(mapped)
+			munmap(const_cast<char *>(text), size);
+	#endif
+}
+
+bool SourceFile::open(const std::string &name, bool split){
+	this->name = name;
+	#if defined(UNIX)
+		int fd = ::open(name.c_str(), O_RDONLY);
+		if(fd < 0){
+			emit_error("Error reading from file `" + name + "`: `" + std::strerror(errno) + "`");
+			return false;
+		}
+		// regular files are mapped; anything else (pipes, empty files) is read
+		struct stat st;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+			void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(addr != MAP_FAILED){
+				madvise(addr, st.st_size, MADV_SEQUENTIAL);
+				text = static_cast<const char *>(addr);
+				size = st.st_size;
+				mapped = true;
+			}
+		}
+		close(fd);
+		if(!mapped && !read_file())
+			return false;
+	#else
+		if(!read_file())
+			return false;
+	#endif
+	if(split)
+		split_lines();
+	return true;
+}
+
+bool SourceFile::read_file(){
+	std::ifstream fs(name.c_str(), std::ios_base::in | std::ios_base::binary);
+	if(fs.fail()){
+		emit_error("Error reading from file `" + name + "`: `" + std::strerror(errno) + "`");
+		return false;
+	}
+	buffer.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+	text = buffer.data();
+	size = buffer.size();
+	return true;
+}
+
+void SourceFile::split_lines(){
+	unsigned line_number = 0;
+	for(size_t pos = 0; pos < size;){
+		const char *end = static_cast<const char *>(std::memchr(text + pos, '\n', size - pos));
+		size_t length = end ? end - (text + pos) : size - pos;
+		SourceLine line(this, ++line_number, pos, length);
+		if(line.is_include() || line.get_stripped().length > 0)
+			lines.push_back(line);
+		pos += length + 1;
+	}
+}
+
+const std::string &SourceFile::get_name() const {
+	return name;
+}
+const char *SourceFile::get_text() const {
+	return text;
+}
+size_t SourceFile::get_size() const {
+	return size;
+}
+uint64_t SourceFile::get_hash() const {
+	// a word at a time; the file may be tens of MB
+	uint64_t hash = size;
+	size_t i = 0;
+	for(uint64_t word; i + 8 <= size; i += 8){
+		std::memcpy(&word, text + i, 8);
+		hash = (hash ^ word) * UINT64_C(0x9E3779B97F4A7C15);
+		hash ^= hash >> 29;
+	}
+	for(; i < size; ++i)
+		hash = (hash ^ static_cast<uint8_t>(text[i])) * UINT64_C(0x100000001B3);
+	return hash;
+}
+const std::vector<SourceLine> &SourceFile::get_lines() const {
+	return lines;
 }
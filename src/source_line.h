@@ -1,33 +1,84 @@
 #ifndef SOURCE_LINE_H
 #define SOURCE_LINE_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
+class SourceFile;
+
+// characters inside the text of a SourceFile (std::string_view is C++17)
+struct Slice{
+	const char *data;
+	size_t length;
+
+	inline char operator[](size_t i) const {
+		return data[i];
+	}
+	inline std::string str() const {
+		return std::string(data, length);
+	}
+};
+
+// a line of a SourceFile; refers to the text of the file instead of copying it
 class SourceLine{
 	public:
-		SourceLine() = default;
-		SourceLine(std::string file_name, unsigned line_number, std::string source);
+		SourceLine(const SourceFile *file, unsigned line_number, size_t offset, size_t length);
 
-		std::string get_source() const;
-		// returns string without comments, and right-trimmed
-		std::string get_stripped() const;
+		Slice get_source() const;
+		// returns line without comments, and right-trimmed
+		Slice get_stripped() const;
 
 		bool is_include() const;
 
 		void emit_warning(std::string text, unsigned charPos) const;
 		void emit_error(std::string text, unsigned charPos) const;
 
-		std::string get_file_name() const;
+		const std::string &get_file_name() const;
 		unsigned get_line_number() const;
 
 		bool is_spaced() const;
 
-		std::string get_cell_text(uint16_t cell) const;
+		// the two characters of a cell; fewer at the end of the line
+		Slice get_cell_text(uint16_t cell) const;
 	private:
-		std::string file_name;
+		const SourceFile *file;
+		size_t offset; // of the first character in the file
+		uint32_t length, stripped_length;
 		unsigned line_number;
-		std::string source;
 		bool spaced;
 };
 
+// text of a source file, mapped into memory where possible, and its lines
+class SourceFile{
+	public:
+		SourceFile() = default;
+		SourceFile(const SourceFile &) = delete;
+		SourceFile &operator=(const SourceFile &) = delete;
+		~SourceFile();
+
+		// reads the file and splits it into lines unless split is false; returns false
+		// (after emitting an error) if it cannot be read
+		bool open(const std::string &name, bool split = true);
+
+		const std::string &get_name() const;
+		const char *get_text() const;
+		size_t get_size() const;
+		// hash of the text, to tell whether files are the same
+		uint64_t get_hash() const;
+		// lines with something other than whitespace and comments, and #include lines
+		const std::vector<SourceLine> &get_lines() const;
+	private:
+		std::string name;
+		const char *text = nullptr;
+		size_t size = 0;
+		bool mapped = false;
+		std::vector<char> buffer; // holds the text when the file cannot be mapped
+		std::vector<SourceLine> lines;
+
+		bool read_file();
+		void split_lines();
+};
+
 #endif
@@ -3,7 +3,6 @@
 #include <cstdlib>
 #include <deque>
 #include <iostream>
-#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -13,14 +12,19 @@
 
 #include "board.h"
 #include "emit.h"
+#include "interpreter.h"
 #include "io_functions.h"
-#include "load.h"
 #include "options.h"
 #include "surfaces.h"
 
 option::Option *options;
 int verbosity = 0;
 bool cylindrical;
+Engine engine;
+unsigned long max_depth = 0;
+uint64_t random_seed;
+CyclePolicy on_cycle = CYCLE_IGNORE; // not detected while animating
+bool parallel_calls = false;
 
 struct State {
 	int width, height;
@@ -33,6 +37,7 @@ struct State {
 	cairo_surface_t *devices_surface, *printables_surface, *marble_surface, *cn16_surface;
 	GtkWidget *window, *mwindow, *grid, *lgrid, *bwindow, *swindow, *cgrid, *draw_area, *sdraw_area;
 	GtkWidget *stdout_window, *stdout_label;
+	const MemoryOutput *saved_stdout; // output of the program, shown as it grows
 	GtkWidget *play_toggle, *tick_once, *finish;
 	cairo_surface_t *swindow_surface;
 
@@ -193,15 +198,17 @@ int main(int argc, char *argv[]){
 	}
 
 	std::string filename = parse.nonOption(0);
+	// board routes depend on cylindrical
+	cylindrical = (options[OPT_CYLINDRICAL].last()->type() == OPT_TYPE_ENABLE);
 	// load
-	std::srand(std::time(nullptr));
 	prepare_io(true);
-	std::vector<Board> boards;
-	std::map<std::string, unsigned> lookup;
-	if(!load_mbl_file(filename, boards, lookup)){
+	Interpreter interpreter;
+	interpreter.settings.cylindrical = cylindrical;
+	if(!interpreter.load(filename)){
 		emit_error("Could not load file " + filename);
 		return -3;
 	}
+	std::deque<Board> &boards = interpreter.boards;
 
 	// get highest input
 	int highest_input = -1;
@@ -219,9 +226,22 @@ int main(int argc, char *argv[]){
 	}
 
 	// misc options
-	cylindrical = (options[OPT_CYLINDRICAL].last()->type() == OPT_TYPE_ENABLE);
+	engine = ENGINE_SCAN;
+	if(options[OPT_ENGINE] && !parse_engine(options[OPT_ENGINE].last()->arg, engine)){
+		emit_error(std::string("Unknown engine: ") + options[OPT_ENGINE].last()->arg);
+		return -5;
+	}
+	// lanes only run --batch records
+	if(engine == ENGINE_LANES)
+		engine = ENGINE_BYTECODE;
+	random_seed = std::time(nullptr);
+	if(options[OPT_SEED] && !option_value(*options[OPT_SEED].last(), UINT64_MAX, random_seed)){
+		prepare_io(false);
+		return -5;
+	}
 
-	BoardCall bc{&boards[0], 0, 0};
+	interpreter.settings = option_settings();
+	BoardCall bc = interpreter.main_call();
 	uint8_t inputs[36] = { 0 };
 
 	for(int i = 0; i <= highest_input; ++i){
@@ -245,7 +265,8 @@ int main(int argc, char *argv[]){
 		}
 	}
 
-	stdout_write = _stdout_save;	
+	MemoryOutput *saved_stdout = new MemoryOutput;
+	interpreter.output.reset(saved_stdout);
 
 	// GTK window setup
 	gtk_init(nullptr, nullptr);
@@ -257,6 +278,7 @@ int main(int argc, char *argv[]){
 	state.draw_area_width = std::max(700, 10 + 48 * (boards[0].width + 2));
 	state.draw_area_height = std::max(544, 10 + 48 * (boards[0].height + 1));
 	state.swindow_height = 16;
+	state.saved_stdout = saved_stdout;
 	state.rs = bc.new_run_state(inputs);
 	state.rs_stack.push_front(state.rs);
 	state.devices_surface = create_devices_surface();
@@ -358,7 +380,7 @@ static void stop_board_movement(State *state){
 }
 
 static void flush_stdout(State *state){
-	const auto &outv = stdout_get_saved();
+	const auto &outv = state->saved_stdout->text;
 	if(outv.size() > state->pstdout.length()){
 		for(int i = state->pstdout.length(), len = outv.size(); i < len; ++i)
 			if(outv[i] == 0 || outv[i] > 0x7F)
@@ -426,9 +448,9 @@ static gboolean on_bdraw_event(GtkWidget *, cairo_t *cr, State *state){
 		for(int y = 0; y < board->height; ++y){
 			for(int x = 0; x < board->width; ++x){
 				int index = board->index(x, y);
-				uint16_t value = state->rs->cur_marbles[index];
-				if(value & 0xFF00)
-					draw_marble(cr, state->printables_surface, state->marble_surface, value & 0xFF, offx + 48 * x, offy + 48 * y);
+				if(state->rs->cur_marbles.has_marble(index))
+					draw_marble(cr, state->printables_surface, state->marble_surface, state->rs->cur_marbles.values[index],
+					            offx + 48 * x, offy + 48 * y);
 			}
 		}
 	}else{
@@ -500,30 +522,7 @@ static gboolean tick_board(State *state){
 	if(state->movement_frame != 0){
 		++state->movement_frame;
 		not_finished = true;
-	}else if(state->rs->prepared_board_calls.size() != 0){
-		state->movement_frame = 6;
-
-		state->rs = state->rs->prepared_board_calls[0];
-		state->rs_stack.push_front(state->rs);
-
-		cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 90, state->swindow_height + 18);
-		cairo_t *tmp = cairo_create(surf);
-		// copy over
-		cairo_set_line_width(tmp, 0);
-		cairo_rectangle(tmp, 0, 18, 90, state->swindow_height);
-		cairo_set_source_surface(tmp, state->swindow_surface, 0, 18);
-		cairo_paint(tmp);
-		// add new board
-		draw_text_cn16(tmp, state->cn16_surface, state->rs->bc->board->short_name.substr(0, 7), 0, 0);
-		// cleanup
-		cairo_destroy(tmp);
-		cairo_surface_destroy(state->swindow_surface);
-		state->swindow_surface = surf;
-		state->swindow_height += 18;
-		gtk_widget_queue_draw(state->sdraw_area);
-
-		not_finished = true;
-	}else if(state->rs->is_finished()){
+	}else if(!state->rs->mid_tick() && state->rs->is_finished()){
 		state->rs->finalize();
 		if(state->rs_stack.size() == 1){
 			not_finished = false;
@@ -544,19 +543,37 @@ static gboolean tick_board(State *state){
 
 			state->rs_stack.pop_front();
 			BoardCall::RunState *top = state->rs_stack.front();
-			top->prepared_board_calls.erase(top->prepared_board_calls.begin());
-			top->processed_board_calls.push_back(state->rs);
+			top->resume(state->rs);
 			state->rs = top;
 			not_finished = true;
 		}
-	}else if(state->rs->processed_board_calls.size() != 0){
-		state->rs->tick();
-		++state->movement_frame;
+	}else if(BoardCall::RunState *rs = state->rs->step()){
+		// step into the board call
+		state->movement_frame = 6;
+
+		state->rs = rs;
+		state->rs_stack.push_front(state->rs);
+
+		cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 90, state->swindow_height + 18);
+		cairo_t *tmp = cairo_create(surf);
+		// copy over
+		cairo_set_line_width(tmp, 0);
+		cairo_rectangle(tmp, 0, 18, 90, state->swindow_height);
+		cairo_set_source_surface(tmp, state->swindow_surface, 0, 18);
+		cairo_paint(tmp);
+		// add new board
+		draw_text_cn16(tmp, state->cn16_surface, state->rs->bc->board->short_name.substr(0, 7), 0, 0);
+		// cleanup
+		cairo_destroy(tmp);
+		cairo_surface_destroy(state->swindow_surface);
+		state->swindow_surface = surf;
+		state->swindow_height += 18;
+		gtk_widget_queue_draw(state->sdraw_area);
+
 		not_finished = true;
 	}else{
-		state->rs->prepare_board_calls();
-		if(state->rs->prepared_board_calls.size() == 0)
-			state->rs->tick(), ++state->movement_frame;
+		// tick completed
+		++state->movement_frame;
 		not_finished = true;
 	}
 	flush_stdout(state);
@@ -601,21 +618,7 @@ static void finish_clicked(GtkButton *, State *state){
 		// run to completion
 		state->rs = state->rs_stack.front();
 		state->active_frame = 0;
-		while(state->rs->prepared_board_calls.size() > 0){
-			BoardCall::RunState *rs = state->rs->prepared_board_calls[0];
-			while(rs->tick(false));
-			rs->finalize();
-
-			state->rs->processed_board_calls.push_back(rs);
-			state->rs->prepared_board_calls.erase(state->rs->prepared_board_calls.begin());
-		}
-		if(state->rs->processed_board_calls.size() > 0){
-			if(state->rs->tick(true))
-				while(state->rs->tick(false));
-		}else{
-			while(state->rs->tick(false));
-		}
-		state->rs->finalize();
+		state->rs->run();
 
 		flush_stdout(state);
 		gtk_widget_queue_draw(state->sdraw_area);
@@ -653,17 +656,17 @@ static gboolean board_double_clicked(GtkWidget *, GdkEvent *event, State *state)
 			if(bx >= 0 && bx < board->width && by >= 0 && by < board->height){
 				// valid tile
 				int index = board->index(bx, by);
-				uint16_t &value = state->rs->cur_marbles[index];
-				if(value & 0xFF00){
+				if(state->rs->cur_marbles.has_marble(index)){
 					// marble already present
-					int tmp = prompt_marble_value(state, "Edit Marble", value & 0x00FF);
+					uint8_t &value = state->rs->cur_marbles.values[index];
+					int tmp = prompt_marble_value(state, "Edit Marble", value);
 					if(tmp >= 0)
-						value = 0xFF00 | tmp;
+						value = tmp;
 				}else{
 					// new marble
 					int tmp = prompt_marble_value(state, "New Marble");
 					if(tmp >= 0)
-						value = 0xFF00 | tmp;
+						state->rs->place_marble(index, tmp);
 				}
 			}
 		}
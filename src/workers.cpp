@@ -0,0 +1,140 @@
+#include "workers.h"
+
+#include <algorithm>
+#include <system_error>
+
+WorkerPool workers;
+
+static thread_local unsigned current_worker = 0;
+
+bool Task::done() const {
+	return finished.load(std::memory_order_acquire);
+}
+
+WorkerPool::~WorkerPool(){
+	stop();
+}
+
+bool WorkerPool::start(unsigned count){
+	if(count == 0)
+		count = std::max(1u, std::thread::hardware_concurrency());
+	for(unsigned i = 0; i < count; ++i)
+		queues.emplace_back(new Queue);
+	// std::thread reports running out of threads with an exception
+	try{
+		for(unsigned i = 1; i < count; ++i)
+			threads.emplace_back(&WorkerPool::work, this, i);
+	}catch(const std::system_error &){
+		stop();
+		threads.clear();
+		queues.clear();
+		return false;
+	}
+	return true;
+}
+
+unsigned WorkerPool::max_threads(){
+	return 16 * std::max(1u, std::thread::hardware_concurrency());
+}
+
+void WorkerPool::stop(){
+	{
+		std::lock_guard<std::mutex> guard(idle_lock);
+		stopping = true;
+	}
+	idle.notify_all();
+	for(std::thread &thread : threads)
+		thread.join();
+}
+
+bool WorkerPool::enabled() const {
+	return !threads.empty();
+}
+
+unsigned WorkerPool::size() const {
+	return std::max<size_t>(1, queues.size());
+}
+
+unsigned WorkerPool::current(){
+	return current_worker;
+}
+
+void WorkerPool::push(Task *task){
+	Queue &queue = *queues[current_worker];
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(task);
+	}
+	++queued;
+	// a worker going to sleep counts itself before checking queued, so either it
+	// sees this task or it is counted here
+	if(sleeping){
+		std::lock_guard<std::mutex> guard(idle_lock);
+		idle.notify_one();
+	}
+}
+
+void WorkerPool::wait(const Task &task){
+	while(!task.done()){
+		if(Task *other = take(current_worker))
+			execute(other);
+		else
+			std::this_thread::yield();
+	}
+}
+
+bool WorkerPool::cancel(){
+	return !stopped_early.exchange(true);
+}
+
+bool WorkerPool::cancelled() const {
+	return stopped_early.load(std::memory_order_relaxed);
+}
+
+Task *WorkerPool::take(unsigned worker){
+	if(!queued)
+		return nullptr;
+	// newest of our own tasks first: it is the most likely to be waited for next
+	Task *task = nullptr;
+	{
+		Queue &queue = *queues[worker];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if(!queue.tasks.empty()){
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+	}
+	// then the oldest task of another worker, which tends to be the largest
+	for(size_t i = 1; !task && i < queues.size(); ++i){
+		Queue &queue = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if(!queue.tasks.empty()){
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+	}
+	if(task)
+		--queued;
+	return task;
+}
+
+void WorkerPool::execute(Task *task){
+	task->run();
+	task->finished.store(true, std::memory_order_release);
+}
+
+void WorkerPool::work(unsigned worker){
+	current_worker = worker;
+	while(true){
+		if(Task *task = take(worker)){
+			execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(idle_lock);
+		++sleeping;
+		idle.wait(guard, [this]{ return stopping || queued; });
+		--sleeping;
+		if(stopping)
+			return;
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a piece of work for the worker pool
+class Task{
+	public:
+		virtual ~Task() = default;
+		virtual void run() = 0;
+
+		// true once run() has returned
+		bool done() const;
+	private:
+		friend class WorkerPool;
+		std::atomic<bool> finished{false};
+};
+
+// threads running tasks from one deque per thread: a thread runs the newest task
+// of its own deque first and, when that is empty, steals the oldest task of another
+// thread. the thread that starts the pool takes part as worker 0 whenever it waits
+// for a task
+class WorkerPool{
+	public:
+		~WorkerPool();
+
+		// starts threads - 1 more threads; 0 starts one thread per core
+		// returns false, leaving the pool without threads, if they cannot be created
+		bool start(unsigned threads);
+		// most threads start() is meant for: 16 per core
+		static unsigned max_threads();
+		// true if there are threads to run tasks on
+		bool enabled() const;
+		// number of workers, including worker 0
+		unsigned size() const;
+		// worker the calling thread is, 0 for threads outside the pool
+		static unsigned current();
+
+		// queues a task on the deque of the calling thread
+		void push(Task *task);
+		// runs queued tasks until the given task, which must have been pushed, is done
+		void wait(const Task &task);
+
+		// asks running tasks to stop early; set when a task fails, which ends the program
+		// returns true for the first call, whose failure is the one to report
+		bool cancel();
+		bool cancelled() const;
+	private:
+		struct Queue{
+			std::mutex lock;
+			std::deque<Task *> tasks;
+		};
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+		std::atomic<unsigned> queued{0}, sleeping{0};
+		std::atomic<bool> stopping{false}, stopped_early{false};
+		std::mutex idle_lock;
+		std::condition_variable idle;
+
+		// takes a task from the worker's deque, or steals one; nullptr if there are none
+		Task *take(unsigned worker);
+		void execute(Task *task);
+		void work(unsigned worker);
+		// stops and joins the threads
+		void stop();
+};
+
+// defined in workers.cpp; started by main
+extern WorkerPool workers;
+
+#endif // WORKERS_H